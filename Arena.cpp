@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <new>
+
+#include "Arena.h"
+#include "Common.h"
+
+Arena::Arena(size_t objectSize) :
+  m_objectSize(objectSize),
+  m_stride((HEADER_SIZE + objectSize + 15) & ~(size_t)15),
+  m_free(NULL),
+  m_numLive(0)
+{
+}
+
+Arena::~Arena()
+{
+  for (size_t i = 0; i < m_slabs.size(); i++)
+    ::free(m_slabs[i]);
+}
+
+Arena::Slot* Arena::getSlot(unsigned int index) const
+{
+  return (Slot*)(m_slabs[index / ARENA_SLAB_SIZE] + (index % ARENA_SLAB_SIZE) * m_stride);
+}
+
+void* Arena::allocate()
+{
+  if (!m_free) {
+    char* slab;
+    if (posix_memalign((void**)&slab, 16, m_stride * ARENA_SLAB_SIZE))
+      throw std::bad_alloc();
+
+    // Thread the new slots onto the free list, lowest first
+    unsigned int first = m_slabs.size() * ARENA_SLAB_SIZE;
+    m_slabs.push_back(slab);
+    for (int i = ARENA_SLAB_SIZE - 1; i >= 0; i--) {
+      Slot* slot = getSlot(first + i);
+      slot->index = first + i;
+      slot->generation = 0;
+      slot->nextFree = m_free;
+      m_free = slot;
+    }
+  }
+
+  Slot* slot = m_free;
+  m_free = slot->nextFree;
+  slot->nextFree = NULL;
+  slot->generation++;
+  m_numLive++;
+  return (char*)slot + HEADER_SIZE;
+}
+
+void Arena::free(void* object)
+{
+  if (!object)
+    return;
+
+  Slot* slot = (Slot*)((char*)object - HEADER_SIZE);
+  slot->generation++;
+  slot->nextFree = m_free;
+  m_free = slot;
+  m_numLive--;
+}
+
+Handle Arena::getHandle(const void* object) const
+{
+  Handle handle;
+  if (object) {
+    const Slot* slot = (const Slot*)((const char*)object - HEADER_SIZE);
+    handle.index = slot->index;
+    handle.generation = slot->generation;
+  }
+  return handle;
+}
+
+void* Arena::get(Handle handle) const
+{
+  if (handle.isNull() || handle.index >= m_slabs.size() * ARENA_SLAB_SIZE)
+    return NULL;
+
+  Slot* slot = getSlot(handle.index);
+  return slot->generation == handle.generation ? (char*)slot + HEADER_SIZE : NULL;
+}
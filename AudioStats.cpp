@@ -0,0 +1,102 @@
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include "AudioStats.h"
+
+std::atomic<unsigned long long> AudioStats::s_callbacks(0);
+std::atomic<unsigned long long> AudioStats::s_late(0);
+std::atomic<unsigned long long> AudioStats::s_underflows(0);
+std::atomic<unsigned long long> AudioStats::s_overflows(0);
+std::atomic<unsigned long long> AudioStats::s_droppedPlucks(0);
+std::atomic<unsigned int> AudioStats::s_bins[AUDIO_STATS_BINS];
+std::atomic<float> AudioStats::s_peakLoad(0);
+
+void AudioStats::record(double elapsed, double duration, bool fUnderflow, bool fOverflow)
+{
+  float load = duration > 0 ? elapsed / duration : 0;
+
+  // The last bin also catches everything beyond the histogram's range
+  unsigned int bin = (unsigned int)(load / AUDIO_STATS_BIN_WIDTH);
+  if (bin >= AUDIO_STATS_BINS)
+    bin = AUDIO_STATS_BINS - 1;
+  s_bins[bin].fetch_add(1, std::memory_order_relaxed);
+
+  float peak = s_peakLoad.load(std::memory_order_relaxed);
+  while (load > peak && !s_peakLoad.compare_exchange_weak(peak, load, std::memory_order_relaxed))
+    ;
+
+  if (load > 1)
+    s_late.fetch_add(1, std::memory_order_relaxed);
+  if (fUnderflow)
+    s_underflows.fetch_add(1, std::memory_order_relaxed);
+  if (fOverflow)
+    s_overflows.fetch_add(1, std::memory_order_relaxed);
+  s_callbacks.fetch_add(1, std::memory_order_release);
+}
+
+void AudioStats::take(AudioStatsSnapshot& snapshot)
+{
+  snapshot.callbacks = s_callbacks.load(std::memory_order_acquire);
+  snapshot.late = s_late.load(std::memory_order_relaxed);
+  snapshot.underflows = s_underflows.load(std::memory_order_relaxed);
+  snapshot.overflows = s_overflows.load(std::memory_order_relaxed);
+  snapshot.droppedPlucks = s_droppedPlucks.load(std::memory_order_relaxed);
+  for (unsigned int i = 0; i < AUDIO_STATS_BINS; i++)
+    snapshot.bins[i] = s_bins[i].load(std::memory_order_relaxed);
+  snapshot.peakLoad = s_peakLoad.load(std::memory_order_relaxed);
+}
+
+AudioStatsSnapshot AudioStats::difference(const AudioStatsSnapshot& now, const AudioStatsSnapshot& before)
+{
+  AudioStatsSnapshot period;
+  period.callbacks = now.callbacks - before.callbacks;
+  period.late = now.late - before.late;
+  period.underflows = now.underflows - before.underflows;
+  period.overflows = now.overflows - before.overflows;
+  period.droppedPlucks = now.droppedPlucks - before.droppedPlucks;
+
+  // The exact peak is only kept since start-up; the period's comes from the
+  // top of its highest occupied bin
+  period.peakLoad = 0;
+  for (unsigned int i = 0; i < AUDIO_STATS_BINS; i++) {
+    period.bins[i] = now.bins[i] - before.bins[i];
+    if (period.bins[i])
+      period.peakLoad = (i + 1) * AUDIO_STATS_BIN_WIDTH;
+  }
+  period.peakLoad = std::min(period.peakLoad, now.peakLoad);
+  return period;
+}
+
+float AudioStats::getPercentile(const AudioStatsSnapshot& snapshot, float fraction)
+{
+  unsigned long long total = 0;
+  for (unsigned int i = 0; i < AUDIO_STATS_BINS; i++)
+    total += snapshot.bins[i];
+  if (total == 0)
+    return 0;
+
+  unsigned long long rank = (unsigned long long)(fraction * total + 0.5), count = 0;
+  for (unsigned int i = 0; i < AUDIO_STATS_BINS; i++) {
+    count += snapshot.bins[i];
+    if (count >= rank && count > 0)
+      return (i + 1) * AUDIO_STATS_BIN_WIDTH;
+  }
+  return AUDIO_STATS_BINS * AUDIO_STATS_BIN_WIDTH;
+}
+
+std::string AudioStats::describe(const AudioStatsSnapshot& snapshot)
+{
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(0)
+     << snapshot.callbacks << " callbacks, load"
+     << " p50 " << getPercentile(snapshot, 0.5) * 100 << "%"
+     << " p95 " << getPercentile(snapshot, 0.95) * 100 << "%"
+     << " p99 " << getPercentile(snapshot, 0.99) * 100 << "%"
+     << " peak " << snapshot.peakLoad * 100 << "%, "
+     << snapshot.late << " late, "
+     << snapshot.underflows << " underflows, "
+     << snapshot.overflows << " overflows, "
+     << snapshot.droppedPlucks << " plucks dropped";
+  return os.str();
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <sstream>
 #include <stdlib.h>
 
 #ifdef __MACOSX_CORE__
@@ -16,12 +17,16 @@
 
 #include "Engine.h"
 #include "Network.h"
+#include "Simulation.h"
 
 Engine::Engine() :
-    m_selectedWidget(NULL),
     m_newRoundPad(NULL),
     m_mouseCursor(new Spiral(Point2D(0, 0), 360, 5, 0, 5)),
     m_cursorText(new Text(Point2D(-100, 100), "")),
+    m_voiceText(new Text(Point2D(10, 20), "")),
+    m_simulation(NULL),
+    m_pluckerCircle(new Spiral(Point2D(0, 0), 360, 10, 0, 10)),
+    m_mousePos(-100, -100),
     m_textMode(TEXT_REPLACE),
     m_xLine(Point2D(0, 0), Point2D(0, 0)),
     m_yLine(Point2D(0, 0), Point2D(0, 0))
@@ -29,25 +34,31 @@ Engine::Engine() :
   m_mouseCursor->setColor(Color(51 / (float)255, 153 / (float)255, 1, 1));
   m_mouseCursor->setFilled(true);
   m_cursorText->setColor(Color(51 / (float)255, 153 / (float)255, 1, 1));
+  m_voiceText->setColor(Color(0.6, 0.6, 0.6));
+  m_pluckerCircle->setFilled(true);
+  m_pluckerCircle->setColor(Color(0, 0, 0, 0.5));
   m_xLine.setColor(Color(0.95, 0.95, 0.95, 0.5));
   m_xLine.setLineWidth(0.1);
   m_yLine.setColor(Color(0.95, 0.95, 0.95, 0.5));
   m_yLine.setLineWidth(0.1);
   m_parent = this;
+  SceneIndex::setRoot(this);
 }
 
 Engine::~Engine()
 {
   delete m_mouseCursor;
   delete m_cursorText;
+  delete m_voiceText;
+  delete m_pluckerCircle;
 }
 
 bool Engine::handleDraw(float x, float y)
 {
   m_maxRadius = FLT_MAX;
-  for (std::vector<Widget*>::iterator cit = m_children.begin(); cit != m_children.end(); cit++) {
-    RoundPad* pad = dynamic_cast<RoundPad*>(*cit);
-    if (pad)
+  for (Widget* w = WidgetRegistry::getFirst(WIDGET_PAD); w; w = w->getNextOfType()) {
+    RoundPad* pad = (RoundPad*)w;
+    if (pad->getParent() == this)
       m_maxRadius = std::min(m_maxRadius,
                              Point2D::distance(m_mouseDownPos,
                                                pad->getCenter()) - pad->getRadius());
@@ -77,18 +88,19 @@ bool Engine::handleDrawEnd(float x, float y)
 
 bool Engine::onKeyDown(unsigned char key, float x, float y)
 {
+   Widget* selectedWidget = WidgetRegistry::get(m_selectedWidget);
    switch(key) {
      case 127:
-       if (m_textMode == TEXT_REPLACE && m_selectedWidget &&
-           (m_selectedWidget = m_selectedWidget->getParent()->removeChild(m_selectedWidget))) {
+       if (m_textMode == TEXT_REPLACE && selectedWidget &&
+           (selectedWidget = selectedWidget->getParent()->removeChild(selectedWidget))) {
          for (int i = 0; i < 5; i++)
-           s_network->sendObjectMessage(m_selectedWidget, true);
-         delete m_selectedWidget;
-         m_selectedWidget = NULL;
+           s_network->sendObjectMessage(selectedWidget, true);
+         delete selectedWidget;
+         m_selectedWidget = WidgetHandle();
        } else if (m_textMode == TEXT_APPEND) {
          std::string text;
-         if (m_selectedWidget && dynamic_cast<RoundPad*>(m_selectedWidget)) {
-           RoundPad* pad = (RoundPad*)m_selectedWidget;
+         if (selectedWidget && selectedWidget->getType() == WIDGET_PAD) {
+           RoundPad* pad = (RoundPad*)selectedWidget;
            text = pad->getCommentText()->getText();
            pad->setCommentText(text.substr(0, text.length() - 1));
            s_network->sendRoundPadTextMessage(pad);
@@ -104,8 +116,8 @@ bool Engine::onKeyDown(unsigned char key, float x, float y)
        break;
      default:
        std::string character(1, key);
-       if (m_selectedWidget && dynamic_cast<RoundPad*>(m_selectedWidget)) {
-         RoundPad* pad = (RoundPad*)m_selectedWidget;
+       if (selectedWidget && selectedWidget->getType() == WIDGET_PAD) {
+         RoundPad* pad = (RoundPad*)selectedWidget;
          if (m_textMode == TEXT_REPLACE) {
            pad->setCommentText(character);
            m_textMode = TEXT_APPEND;
@@ -131,10 +143,22 @@ void Engine::draw()
   // clear the color and depth buffers
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  // Highlight whatever the pointer is over, as of this frame
+  SceneIndex::updateHover(m_mousePos.x, m_mousePos.y);
+
   // Draw the elements
   for (int i = 0; i < m_children.size(); i ++)
     m_children[i]->draw();
 
+  // Pluckers move on the simulation thread, so draw them from its snapshot
+  if (m_simulation) {
+    m_simulation->getPluckerPositions(m_pluckerPositions);
+    for (size_t i = 0; i < m_pluckerPositions.size(); i++) {
+      m_pluckerCircle->setCenter(m_pluckerPositions[i]);
+      m_pluckerCircle->draw();
+    }
+  }
+
   // Draw in-progress new round pad, if any
   if (m_newRoundPad)
     m_newRoundPad->draw();
@@ -143,6 +167,18 @@ void Engine::draw()
   for (Network::PeerMap::iterator pit = peers->begin(); pit != peers->end(); pit++)
     pit->second->draw();
 
+  // Sounding versus total strings, to keep an eye on voice sleeping, and
+  // the pluckers: how many are moving, and what the limits cost
+  std::ostringstream os;
+  os << "voices: " << SoundSource::getActiveVoiceCount()
+     << " / " << SoundSource::getTotalVoiceCount()
+     << "  pluckers: " << Plucker::getLiveCount()
+     << " (" << Plucker::getDroppedCount() << " dropped, "
+     << Plucker::getMergedCount() << " merged)";
+  m_voiceText->setText(os.str());
+  m_voiceText->setPos(Point2D(10, m_height - 10));
+  m_voiceText->draw();
+
   m_xLine.draw();
   m_yLine.draw();
   m_mouseCursor->draw();
@@ -151,15 +187,15 @@ void Engine::draw()
 
 void Engine::setMouseCursorPosition(float x, float y)
 {
-  m_mouseCursor->setCenter(Point2D(x, y));
+  m_mousePos = Point2D(x, y);
+  m_mouseCursor->setCenter(m_mousePos);
   m_cursorText->setPos(Point2D(x + 10, y + 5));
 
-  for (std::vector<Widget *>::iterator cit = m_children.begin(); cit != m_children.end(); cit++)
-    if ((*cit)->hitTest(x, y)) {
-      m_xLine.setPoints(Point2D(0, 0), Point2D(0, 0));
-      m_yLine.setPoints(Point2D(0, 0), Point2D(0, 0));
-      return;
-    }
+  if (SceneIndex::pickChild(this, x, y)) {
+    m_xLine.setPoints(Point2D(0, 0), Point2D(0, 0));
+    m_yLine.setPoints(Point2D(0, 0), Point2D(0, 0));
+    return;
+  }
 
   m_xLine.setPoints(Point2D(0, y), Point2D(m_width, y));
   m_yLine.setPoints(Point2D(x, 0), Point2D(x, m_height));
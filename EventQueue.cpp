@@ -0,0 +1,80 @@
+#include <float.h>
+
+#include "EventQueue.h"
+#include "TrackGraph.h"
+#include "StringIndex.h"
+#include "Widget.h"
+#include "Clock.h"
+
+bool EventQueue::s_fEnabled = false;
+bool EventQueue::s_fChanged = true;
+bool EventQueue::s_fFiring = false;
+double EventQueue::s_time = 0;
+unsigned int EventQueue::s_graphVersion = 0;
+unsigned int EventQueue::s_stringVersion = 0;
+std::priority_queue<EventQueue::Event> EventQueue::s_events;
+
+void EventQueue::start(double time)
+{
+  s_fEnabled = true;
+  s_fChanged = true;
+  const std::vector<Track*>& tracks = TrackGraph::getTracks();
+  for (size_t i = 0; i < tracks.size(); i++)
+    tracks[i]->setTime(time);
+}
+
+double EventQueue::getTime()
+{
+  return s_fFiring ? s_time : Clock::now();
+}
+
+void EventQueue::schedule(Track* track)
+{
+  Event event;
+  event.time = track->predictEvent();
+  event.track = track;
+  event.serial = track->nextEventSerial();
+  if (event.time < DBL_MAX)
+    s_events.push(event);
+}
+
+void EventQueue::update(double time)
+{
+  // Deleted tracks leave the graph, so a new graph also means no event
+  // points at one
+  if (!s_fChanged && s_graphVersion == TrackGraph::getVersion() &&
+      s_stringVersion == StringIndex::getVersion())
+    return;
+  s_fChanged = false;
+  s_graphVersion = TrackGraph::getVersion();
+  s_stringVersion = StringIndex::getVersion();
+
+  s_events = std::priority_queue<Event>();
+  const std::vector<Track*>& tracks = TrackGraph::getTracks();
+  for (size_t i = 0; i < tracks.size(); i++)
+    tracks[i]->syncTo(time);
+  for (size_t i = 0; i < tracks.size(); i++)
+    schedule(tracks[i]);
+}
+
+void EventQueue::fire(double time)
+{
+  s_fFiring = true;
+  while (getNextTime() <= time) {
+    Event event = s_events.top();
+    s_events.pop();
+
+    // Pluckers split here land on other tracks, which reschedule themselves
+    s_time = event.time;
+    event.track->syncTo(event.time);
+    schedule(event.track);
+  }
+  s_fFiring = false;
+}
+
+double EventQueue::getNextTime()
+{
+  while (!s_events.empty() && s_events.top().serial != s_events.top().track->getEventSerial())
+    s_events.pop();
+  return s_events.empty() ? DBL_MAX : s_events.top().time;
+}
@@ -0,0 +1,50 @@
+#include "InputQueue.h"
+
+std::vector<InputEvent> InputQueue::s_events;
+
+void InputQueue::pushMotion(int x, int y)
+{
+  // Only the last position since the previous button or key matters
+  if (!s_events.empty() && s_events.back().type == InputEvent::MOTION) {
+    s_events.back().x = x;
+    s_events.back().y = y;
+    return;
+  }
+
+  InputEvent event;
+  event.type = InputEvent::MOTION;
+  event.button = event.state = 0;
+  event.key = 0;
+  event.x = x;
+  event.y = y;
+  s_events.push_back(event);
+}
+
+void InputQueue::pushButton(int button, int state, int x, int y)
+{
+  InputEvent event;
+  event.type = InputEvent::BUTTON;
+  event.button = button;
+  event.state = state;
+  event.key = 0;
+  event.x = x;
+  event.y = y;
+  s_events.push_back(event);
+}
+
+void InputQueue::pushKey(unsigned char key, int x, int y)
+{
+  InputEvent event;
+  event.type = InputEvent::KEY;
+  event.button = event.state = 0;
+  event.key = key;
+  event.x = x;
+  event.y = y;
+  s_events.push_back(event);
+}
+
+void InputQueue::take(std::vector<InputEvent>& events)
+{
+  events.clear();
+  events.swap(s_events);
+}
@@ -0,0 +1,102 @@
+#include <math.h>
+#include <assert.h>
+#include <algorithm>
+
+#include "JointIndex.h"
+#include "Widget.h"
+
+std::map<long long, std::vector<Joint*> > JointIndex::s_cells;
+unsigned int JointIndex::s_numJoints = 0;
+
+static inline int getCell(float coordinate)
+{
+  return (int)floor(coordinate / JOINT_INDEX_CELL);
+}
+
+static inline long long packCell(int cx, int cy)
+{
+  return ((long long)cx << 32) | (unsigned int)cy;
+}
+
+long long JointIndex::getKey(Point2D p)
+{
+  return packCell(getCell(p.x), getCell(p.y));
+}
+
+void JointIndex::insert(Joint* joint)
+{
+  if (!joint || joint->isIndexed())
+    return;
+
+  long long key = getKey(joint->getCenter());
+  s_cells[key].push_back(joint);
+  joint->setIndexKey(true, key);
+  s_numJoints++;
+}
+
+void JointIndex::remove(Joint* joint)
+{
+  if (!joint || !joint->isIndexed())
+    return;
+
+  // Joints are filed under the key they keep, not where they are now, so an
+  // indexed one is always in that cell
+  std::map<long long, std::vector<Joint*> >::iterator cit = s_cells.find(joint->getIndexKey());
+  assert(cit != s_cells.end());
+  std::vector<Joint*>& cell = cit->second;
+  std::vector<Joint*>::iterator jit = std::find(cell.begin(), cell.end(), joint);
+  assert(jit != cell.end());
+  cell.erase(jit);
+  if (cell.empty())
+    s_cells.erase(cit);
+  joint->setIndexKey(false, 0);
+  s_numJoints--;
+}
+
+void JointIndex::move(Joint* joint)
+{
+  if (!joint->isIndexed() || joint->getIndexKey() == getKey(joint->getCenter()))
+    return;
+
+  remove(joint);
+  insert(joint);
+}
+
+static Point2D s_origin; // Of the last findAll(), for sorting by distance
+
+static bool compareDistances(Joint* a, Joint* b)
+{
+  return Point2D::distance(s_origin, a->getCenter()) < Point2D::distance(s_origin, b->getCenter());
+}
+
+void JointIndex::findAll(Point2D p, float radius, std::vector<Joint*>& joints)
+{
+  joints.clear();
+
+  int x1 = getCell(p.x - radius), y1 = getCell(p.y - radius),
+      x2 = getCell(p.x + radius), y2 = getCell(p.y + radius);
+  for (int cx = x1; cx <= x2; cx++)
+    for (int cy = y1; cy <= y2; cy++) {
+      std::map<long long, std::vector<Joint*> >::iterator cit = s_cells.find(packCell(cx, cy));
+      if (cit == s_cells.end())
+        continue;
+
+      const std::vector<Joint*>& cell = cit->second;
+      for (size_t i = 0; i < cell.size(); i++)
+        if (Point2D::distance(p, cell[i]->getCenter()) <= radius)
+          joints.push_back(cell[i]);
+    }
+
+  s_origin = p;
+  std::sort(joints.begin(), joints.end(), compareDistances);
+}
+
+Joint* JointIndex::find(Point2D p, float radius, const Joint* except)
+{
+  static std::vector<Joint*> joints;
+  findAll(p, radius, joints);
+  for (size_t i = 0; i < joints.size(); i++)
+    if (joints[i] != except)
+      return joints[i];
+  return NULL;
+}
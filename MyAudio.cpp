@@ -21,6 +21,10 @@ MyAudio::MyAudio( unsigned int nChann, float sr, unsigned int buffSize, RtAudioF
   m_sampleRate = sr;
   m_bufferSize = buffSize;
   m_format = format;
+  m_deviceId = -1;
+  m_fOutputOnly = false;
+  m_callback = NULL;
+  m_userData = NULL;
 }
 
 // destructor
@@ -61,34 +65,105 @@ void MyAudio::setup( RtAudioCallback callback, void * userData )
   // let RtAudio print messages to stderr.
   m_audio->showWarnings( true );
 
+  m_callback = callback;
+  m_userData = userData;
+
+  // set the callback and open the stream
+  try
+  {
+    openStream();
+    std::cerr << "Buffer size defined by RtAudio: " << m_bufferSize << std::endl;
+  }
+  catch( RtError & err )
+  {
+    err.printMessage();
+    exit(1);
+  }
+
+}
+
+// (re)open the stream with the current settings
+void MyAudio::openStream()
+{
   // set input and output parameters
   RtAudio::StreamParameters iParams, oParams;
-  iParams.deviceId = m_audio->getDefaultInputDevice();
+  iParams.deviceId = m_deviceId < 0 ? m_audio->getDefaultInputDevice() : m_deviceId;
   iParams.nChannels = m_numChannels;
   iParams.firstChannel = 0;
-  oParams.deviceId = m_audio->getDefaultOutputDevice();
+  oParams.deviceId = m_deviceId < 0 ? m_audio->getDefaultOutputDevice() : m_deviceId;
   oParams.nChannels = m_numChannels;
   oParams.firstChannel = 0;
 
-  // set the callback and start stream
+  // the input is never read, so it can be left closed
+  m_audio->openStream( &oParams,
+      m_fOutputOnly ? NULL : &iParams,
+      m_format,
+      m_sampleRate,
+      &m_bufferSize,
+      m_callback,
+      m_userData);
+}
+
+// restart the stream with another buffer size
+bool MyAudio::reopen( unsigned int buffSize )
+{
+  unsigned int previous = m_bufferSize;
+  stop();
+
   try
   {
-    m_audio->openStream( &oParams,
-        &iParams,
-        m_format,
-        m_sampleRate,
-        &m_bufferSize,
-        callback,
-        userData);
-
-    std::cerr << "Buffer size defined by RtAudio: " << m_bufferSize << std::endl;
+    m_bufferSize = buffSize;
+    openStream();
   }
   catch( RtError & err )
   {
     err.printMessage();
-    exit(1);
+    m_bufferSize = previous;
+    try
+    {
+      openStream();
+    }
+    catch( RtError & err )
+    {
+      err.printMessage();
+      exit(1);
+    }
+    start();
+    return false;
   }
 
+  start();
+  return true;
+}
+
+// list the available devices
+void MyAudio::listDevices()
+{
+  try
+  {
+    RtAudio audio;
+    for( unsigned int i = 0; i < audio.getDeviceCount(); i++ )
+    {
+      RtAudio::DeviceInfo info = audio.getDeviceInfo( i );
+      if( !info.probed )
+        continue;
+
+      std::cout << i << ": " << info.name
+                << " (" << info.outputChannels << " out, " << info.inputChannels << " in";
+      if( info.isDefaultOutput )
+        std::cout << ", default output";
+      if( info.isDefaultInput )
+        std::cout << ", default input";
+      std::cout << ") rates:";
+      for( unsigned int j = 0; j < info.sampleRates.size(); j++ )
+        std::cout << " " << info.sampleRates[j];
+      std::cout << std::endl;
+    }
+  }
+  catch( RtError & err )
+  {
+    err.printMessage();
+  }
 }
 
 // start audio stream
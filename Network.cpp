@@ -1,4 +1,6 @@
 #include "include/Network.h"
+#include "include/AudioStats.h"
+#include "include/Simulation.h"
 
 // ===================
 // Peer implementation
@@ -107,6 +109,9 @@ Network::Network() : m_engine(NULL)
   m_handlers.insert(HandlerData("/object/track/string", &Network::handleObjectStringMessage));
   m_handlers.insert(HandlerData("/object/delete",       &Network::handleObjectDeleteMessage));
   m_handlers.insert(HandlerData("/object/query",        &Network::handleObjectQueryMessage));
+
+  m_handlers.insert(HandlerData("/stats/query",         &Network::handleStatsQueryMessage));
+  m_handlers.insert(HandlerData("/stats/audio",         &Network::handleStatsAudioMessage));
 }
 
 Network::~Network()
@@ -127,9 +132,9 @@ void Network::rescueOrphans()
     if ((wit = widgets->find(oit->first)) != widgets->end()) { // parent found?!!
       // De-orphan it
       wit->second->addChild(oit->second);
-      if (dynamic_cast<SpiralTrack*>(oit->second))
+      if (oit->second->getType() == WIDGET_SPIRAL_TRACK)
         ((SpiralTrack*)oit->second)->setCenter(((RoundPad*)wit->second)->getCenter());
-      else if (dynamic_cast<String*>(oit->second))
+      else if (oit->second->getType() == WIDGET_STRING)
         ((String*)oit->second)->setPadRadius(((RoundPad*)wit->second)->getRadius());
       wit = widgets->insert(WidgetData(oit->second->getUuid(), oit->second)).first;
       m_orphans.erase(oit);
@@ -189,6 +194,7 @@ void Network::addPeer(Peer& peer)
 void Network::ProcessMessage(const osc::ReceivedMessage& m,
                              const IpEndpointName& remoteEndpoint)
 {
+  Simulation::lockScene();
   try {
     std::string address = m.AddressPattern();
     if (address != "/mouse/position") // too noisy!
@@ -200,6 +206,7 @@ void Network::ProcessMessage(const osc::ReceivedMessage& m,
   }
 
   rescueOrphans();
+  Simulation::unlockScene();
 }
 
 void Network::sendPeerUpMessage()
@@ -382,15 +389,17 @@ void Network::sendRoundPadTextMessage(const RoundPad* pad)
   broadcast(ps);
 }
 
-void Network::sendPlucker(const Track* track)
+void Network::sendPlucker(const Track* track, unsigned long long tick)
 {
   // Utility data structures
   char buffer[1024];
   osc::OutboundPacketStream ps(buffer, 1024);
 
   ps << osc::BeginMessage("/object/plucker")
-     << osc::Symbol(track->getUuid())
-     << osc::EndMessage;
+     << osc::Symbol(track->getUuid());
+  if (tick)
+    ps << (osc::int64)tick;
+  ps << osc::EndMessage;
 
   broadcast(ps);
 }
@@ -437,7 +446,7 @@ void Network::handleObjectPadTextMessage(const osc::ReceivedMessage& m,
 
   WidgetMap* widgets = Widget::getAll();
   WidgetMap::iterator wit = widgets->find(std::string(uuid));
-  if (wit != widgets->end() && dynamic_cast<RoundPad*>(wit->second))
+  if (wit != widgets->end() && wit->second->getType() == WIDGET_PAD)
     ((RoundPad*)wit->second)->setCommentText(std::string(text));
 }
 
@@ -448,14 +457,26 @@ void Network::handlePluckerMessage(const osc::ReceivedMessage& m,
   char buffer[1024];
   osc::OutboundPacketStream ps(buffer, 1024);
 
-  // Parse OSC message
+  // Parse OSC message; the step to start at is only sent in lockstep
   osc::Symbol uuid;
-  m.ArgumentStream() >> uuid >> osc::EndMessage;
-  std::cerr << uuid << std::endl;
+  osc::int64 tick = 0;
+  osc::ReceivedMessageArgumentStream args = m.ArgumentStream();
+  args >> uuid;
+  if (m.ArgumentCount() > 1)
+    args >> tick;
+  args >> osc::EndMessage;
 
   WidgetMap* widgets = Widget::getAll();
   WidgetMap::iterator wit = widgets->find(std::string(uuid));
-  if (wit != widgets->end() && dynamic_cast<Track*>(wit->second))
+  if (wit == widgets->end() || !wit->second->isTrack())
+    return;
+
+  Simulation* simulation = m_engine->getSimulation();
+  if (tick && simulation && simulation->isLockstep())
+    simulation->queuePlucker((Track*)wit->second, tick);
+  else if (simulation)
+    simulation->addPlucker((Track*)wit->second);
+  else
     ((Track*)wit->second)->addPlucker();
 }
 
@@ -489,25 +510,9 @@ void Network::handleObjectSpiralMessage(const osc::ReceivedMessage& m,
         Point2D center = ((RoundPad*)wit->second)->getCenter();
         Point2D startPoint = Spiral::getPointFromRadius(center, startRadius, startAngle);
         Point2D endPoint = Spiral::getPointFromRadius(center, endRadius, endAngle);
-        Joint *endJoint = NULL, *startJoint = NULL;
-        std::vector<Widget*>* children = wit->second->getChildren();
-
-        for (int i = children->size() - 1; i >= 0; i --) {
-          Track *track = dynamic_cast<Track *>(children->at(i));
-          if (track) {
-            Joint *joint = track->getJoint1();
-            if (!startJoint && joint && joint->hitTest(startPoint.x, startPoint.y))
-              startJoint = joint;
-            else if (!endJoint && joint && joint->hitTest(endPoint.x, endPoint.y))
-              endJoint = joint;
-
-            joint = track->getJoint2();
-            if (!startJoint && joint && joint->hitTest(startPoint.x, startPoint.y))
-              startJoint = joint;
-            else if (!endJoint && joint && joint->hitTest(endPoint.x, endPoint.y))
-              endJoint = joint;
-          }
-        }
+        RoundPad* pad = (RoundPad*)wit->second;
+        Joint *startJoint = pad->findJoint(startPoint);
+        Joint *endJoint = pad->findJoint(endPoint, startJoint);
 
         newSpiral = new SpiralTrack(center, startAngle, startRadius,
                                     endAngle, endRadius, startJoint, endJoint);
@@ -559,23 +564,8 @@ void Network::handleObjectLineMessage(const osc::ReceivedMessage& m,
       // Search for pad
       wit = widgets->find(std::string(padUuid));
       if (wit != widgets->end()) {
-        Joint *endJoint = NULL, *startJoint = NULL;
-        for (WidgetMap::iterator ptr = widgets->begin(); ptr != widgets->end(); ptr++) {
-          Track *track = dynamic_cast<Track *>(ptr->second);
-          if (track) {
-            Joint *joint = track->getJoint1();
-            if (!startJoint && joint && joint->hitTest(startX, startY))
-              startJoint = joint;
-            else if (!endJoint && joint && joint->hitTest(endX, endY))
-              endJoint = joint;
-
-            joint = track->getJoint2();
-            if (!startJoint && joint && joint->hitTest(startX, startY))
-              startJoint = joint;
-            else if (!endJoint && joint && joint->hitTest(endX, endY))
-              endJoint = joint;
-          }
-        }
+        Joint *startJoint = JointIndex::find(Point2D(startX, startY), JOINT_RADIUS);
+        Joint *endJoint = JointIndex::find(Point2D(endX, endY), JOINT_RADIUS, startJoint);
 
         LineTrack* newLine = new LineTrack(Point2D(startX, startY), Point2D(endX, endY), startJoint, endJoint);
         newLine->setUuid(uuid);
@@ -613,12 +603,8 @@ void Network::handleObjectStringMessage(const osc::ReceivedMessage& m,
             << endX << ", " << endY << std::endl;
 
   // Check for known arc, add & broadcast if unknown
-  bool unlocked = false;
-  SoundSource::lockGlobals();
-
-  SoundSourceMap* soundSources = SoundSource::getAllForEngine();
   WidgetMap* widgets = Widget::getAll();
-  if (soundSources->find(std::string(uuid)) == soundSources->end()) {
+  if (!SoundSource::hasGlobal(std::string(uuid))) {
     WidgetMap::iterator wit = m_orphans.find(std::string(uuid));
     if (wit == m_orphans.end()) {
       // Search for pad
@@ -627,7 +613,7 @@ void Network::handleObjectStringMessage(const osc::ReceivedMessage& m,
         String* newString = new String(Point2D(startX, startY), Point2D(endX, endY), 1);
         newString->setUuid(uuid);
         // Add string to soundsource
-        soundSources->insert(SoundSourceData(newString->getUuid(), newString));
+        SoundSource::addGlobal(newString);
 
         wit->second->addChild(newString);
         newString->setPadRadius(((RoundPad*)wit->second)->getRadius());
@@ -640,14 +626,8 @@ void Network::handleObjectStringMessage(const osc::ReceivedMessage& m,
         newString->setUuid(uuid);
         m_orphans.insert(WidgetData(std::string(padUuid), newString));
       }
-
-      SoundSource::unlockGlobals();
-      unlocked = true;
     }
   }
-
-  if (!unlocked)
-    SoundSource::unlockGlobals();
 }
 
 void Network::handleMousePositionMessage(const osc::ReceivedMessage& m,
@@ -690,3 +670,55 @@ void Network::handleObjectQueryMessage(const osc::ReceivedMessage& m,
 {
   // TODO: well, maybe...
 }
+
+void Network::handleStatsQueryMessage(const osc::ReceivedMessage& m,
+                                      const IpEndpointName& remoteEndpoint)
+{
+  // Peers send their listen port, as in the other messages; external tools
+  // send nothing and are answered on the port they sent from
+  osc::int32 port = 0;
+  osc::ReceivedMessageArgumentStream args = m.ArgumentStream();
+  if (m.ArgumentCount() > 0)
+    args >> port;
+  args >> osc::EndMessage;
+
+  // Totals since start-up, sent back to whoever asked
+  AudioStatsSnapshot stats;
+  AudioStats::take(stats);
+
+  char buffer[1024];
+  osc::OutboundPacketStream ps(buffer, 1024);
+  ps << osc::BeginMessage("/stats/audio")
+     << (osc::int32)m_port
+     << (osc::int64)stats.callbacks
+     << (osc::int64)stats.late
+     << (osc::int64)stats.underflows
+     << (osc::int64)stats.overflows
+     << (osc::int64)stats.droppedPlucks
+     << AudioStats::getPercentile(stats, 0.5)
+     << AudioStats::getPercentile(stats, 0.95)
+     << AudioStats::getPercentile(stats, 0.99)
+     << stats.peakLoad
+     << osc::EndMessage;
+
+  UdpTransmitSocket socket(port ? IpEndpointName(remoteEndpoint.address, (int)port)
+                                : remoteEndpoint);
+  socket.Send(ps.Data(), ps.Size());
+}
+
+void Network::handleStatsAudioMessage(const osc::ReceivedMessage& m,
+                                      const IpEndpointName& remoteEndpoint)
+{
+  // Parse OSC message
+  osc::int32 port;
+  osc::int64 callbacks, late, underflows, overflows, droppedPlucks;
+  float p50, p95, p99, peak;
+  m.ArgumentStream() >> port >> callbacks >> late >> underflows >> overflows >> droppedPlucks
+                     >> p50 >> p95 >> p99 >> peak >> osc::EndMessage;
+
+  std::cerr << (int)port << ": " << (long long)callbacks << " callbacks, load"
+            << " p50 " << p50 * 100 << "% p95 " << p95 * 100 << "% p99 " << p99 * 100 << "%"
+            << " peak " << peak * 100 << "%, " << (long long)late << " late, "
+            << (long long)underflows << " underflows, " << (long long)overflows << " overflows, "
+            << (long long)droppedPlucks << " dropped plucks" << std::endl;
+}
@@ -0,0 +1,59 @@
+#include "PluckQueue.h"
+
+// Bounded queue after Dmitry Vyukov's design: each cell carries a sequence
+// number telling producers and the consumer whose turn it is, so the only
+// contended write is the CAS on m_head between producers.
+
+PluckQueue::PluckQueue(unsigned int capacity) :
+  m_head(0),
+  m_tail(0)
+{
+  // Round up to a power of two so positions wrap with a mask
+  unsigned long size = 1;
+  while (size < capacity)
+    size <<= 1;
+
+  m_cells = new Cell[size];
+  m_mask = size - 1;
+  for (unsigned long i = 0; i < size; i++)
+    m_cells[i].sequence.store(i);
+}
+
+PluckQueue::~PluckQueue()
+{
+  delete[] m_cells;
+}
+
+bool PluckQueue::push(const PluckEvent& event)
+{
+  unsigned long pos = m_head.load(std::memory_order_relaxed);
+  Cell* cell;
+
+  for (;;) {
+    cell = &m_cells[pos & m_mask];
+    long diff = (long)cell->sequence.load(std::memory_order_acquire) - (long)pos;
+    if (diff == 0) {
+      if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    } else if (diff < 0)
+      return false; // Full
+    else
+      pos = m_head.load(std::memory_order_relaxed);
+  }
+
+  cell->event = event;
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool PluckQueue::pop(PluckEvent& event)
+{
+  Cell* cell = &m_cells[m_tail & m_mask];
+  if ((long)cell->sequence.load(std::memory_order_acquire) - (long)(m_tail + 1) != 0)
+    return false; // Empty
+
+  event = cell->event;
+  cell->sequence.store(m_tail + m_mask + 1, std::memory_order_release);
+  m_tail++;
+  return true;
+}
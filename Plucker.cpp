@@ -0,0 +1,59 @@
+#include "Plucker.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+// ======================
+// Plucker implementation
+// ======================
+
+std::atomic<unsigned int> Plucker::s_numLive(0);
+unsigned int Plucker::s_maxTotal = MAX_PLUCKERS;
+unsigned int Plucker::s_maxPerTrack = MAX_TRACK_PLUCKERS;
+std::atomic<unsigned long long> Plucker::s_numDropped(0);
+std::atomic<unsigned long long> Plucker::s_numMerged(0);
+
+void Plucker::setLimits(unsigned int maxTotal, unsigned int maxPerTrack)
+{
+  s_maxTotal = maxTotal;
+  s_maxPerTrack = maxPerTrack;
+}
+
+bool Plucker::reserve()
+{
+  if (s_numLive.load(std::memory_order_relaxed) >= s_maxTotal) {
+    countDropped();
+    return false;
+  }
+
+  s_numLive.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void Plucker::advance(float* s, const float* direction, unsigned int n, float ds, float length)
+{
+  unsigned int i = 0;
+
+#if defined(__AVX__)
+  __m256 step = _mm256_set1_ps(ds), low = _mm256_setzero_ps(), high = _mm256_set1_ps(length);
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_add_ps(_mm256_loadu_ps(s + i), _mm256_mul_ps(_mm256_loadu_ps(direction + i), step));
+    _mm256_storeu_ps(s + i, _mm256_min_ps(_mm256_max_ps(v, low), high));
+  }
+#elif defined(__SSE__)
+  __m128 step = _mm_set1_ps(ds), low = _mm_setzero_ps(), high = _mm_set1_ps(length);
+  for (; i + 4 <= n; i += 4) {
+    __m128 v = _mm_add_ps(_mm_loadu_ps(s + i), _mm_mul_ps(_mm_loadu_ps(direction + i), step));
+    _mm_storeu_ps(s + i, _mm_min_ps(_mm_max_ps(v, low), high));
+  }
+#endif
+
+  // What doesn't fill a whole vector
+  for (; i < n; i++) {
+    float v = s[i] + direction[i] * ds;
+    s[i] = v < 0 ? 0 : (v > length ? length : v);
+  }
+}
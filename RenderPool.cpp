@@ -0,0 +1,284 @@
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <iostream>
+#include <algorithm>
+
+#include "RenderPool.h"
+#include "StringBank.h"
+#include "Widget.h"
+#include "Clock.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX()
+#endif
+
+// Task ranges are packed as job (16 bits), first (24 bits), last (24 bits)
+// so that a worker still busy with an old job can never take from a new one
+#define JOB_MASK 0xffffULL
+#define TASK_MASK 0xffffffULL
+#define NO_JOB 0xffffffff
+
+static inline unsigned long long packTasks(unsigned int job, unsigned int first, unsigned int last)
+{
+  return ((job & JOB_MASK) << 48) | ((first & TASK_MASK) << 24) | (last & TASK_MASK);
+}
+
+static inline unsigned int taskJob(unsigned long long tasks) { return (tasks >> 48) & JOB_MASK; }
+static inline unsigned int taskFirst(unsigned long long tasks) { return (tasks >> 24) & TASK_MASK; }
+static inline unsigned int taskLast(unsigned long long tasks) { return tasks & TASK_MASK; }
+
+RenderPool::RenderPool(unsigned int numThreads, StringBank* bank, unsigned int maxFrames) :
+  m_numThreads(std::max(1u, std::min(numThreads, (unsigned int)MAX_RENDER_THREADS))),
+  m_bank(bank),
+  m_maxFrames(maxFrames),
+  m_job(0),
+  m_sources(NULL),
+  m_nFrames(0),
+  m_numGroups(0),
+  m_numGroupTasks(0),
+  m_numTasks(0),
+  m_inFlight(0),
+  m_fQuit(false),
+  m_serialBuffers(0),
+  m_numMissed(0)
+{
+  m_participants = new Participant[m_numThreads];
+  for (unsigned int i = 0; i < m_numThreads; i++) {
+    Participant& p = m_participants[i];
+    p.pool = this;
+    p.index = i;
+    p.tasks.store(packTasks(0, 0, 0));
+    p.mix = new float[m_bank->getMixSize()];
+    p.buffer = new SAMPLE[m_maxFrames];
+    p.usedJob.store(NO_JOB);
+    p.active = 0;
+    sem_init(&p.wake, 0, 0);
+    p.fSleeping.store(false);
+    p.seenJob = 0;
+  }
+
+  // Participant 0 is the audio thread itself
+  for (unsigned int i = 1; i < m_numThreads; i++)
+    if (!m_participants[i].thread.start(work, &m_participants[i])) {
+      std::cerr << "Error when creating render thread!" << std::endl;
+      exit(1);
+    }
+}
+
+RenderPool::~RenderPool()
+{
+  m_fQuit.store(true);
+  wakeWorkers();
+  for (unsigned int i = 1; i < m_numThreads; i++)
+    m_participants[i].thread.wait();
+
+  for (unsigned int i = 0; i < m_numThreads; i++) {
+    sem_destroy(&m_participants[i].wake);
+    delete[] m_participants[i].mix;
+    delete[] m_participants[i].buffer;
+  }
+  delete[] m_participants;
+}
+
+unsigned int RenderPool::render(const std::vector<SoundSource*>& sources,
+                                SAMPLE* out, unsigned int nFrames, unsigned int stride)
+{
+  nFrames = std::min(nFrames, m_maxFrames);
+  unsigned int numGroups = m_bank->beginBuffer(nFrames);
+  unsigned int numGroupTasks = (numGroups + RENDER_GROUPS_PER_TASK - 1) / RENDER_GROUPS_PER_TASK;
+  unsigned int numTasks = numGroupTasks +
+    (sources.size() + RENDER_SOURCES_PER_TASK - 1) / RENDER_SOURCES_PER_TASK;
+
+  if (m_numThreads == 1 || numTasks < 2 || m_serialBuffers.load() > 0) {
+    if (m_serialBuffers.load() > 0)
+      m_serialBuffers--;
+    return renderSerial(sources, out, nFrames, stride);
+  }
+
+  double start = Clock::now();
+  double deadline = start + RENDER_DEADLINE * nFrames / stk::Stk::sampleRate();
+
+  // Publish the job, then deal out an even share of tasks to everybody
+  unsigned int job = (m_job.load() + 1) & JOB_MASK;
+  m_sources = &sources;
+  m_nFrames = nFrames;
+  m_numGroups = numGroups;
+  m_numGroupTasks = numGroupTasks;
+  m_numTasks = numTasks;
+  for (unsigned int i = 0; i < m_numThreads; i++) {
+    Participant& p = m_participants[i];
+    p.usedJob.store(NO_JOB);
+    p.tasks.store(packTasks(job, numTasks * i / m_numThreads, numTasks * (i + 1) / m_numThreads));
+  }
+  m_job.store(job);
+  wakeWorkers();
+
+  runJob(&m_participants[0], job);
+
+  // Nothing is left to take, but stolen tasks may still be rendering. They
+  // are short, and there is nothing better to do than wait for them.
+  while (m_inFlight.load() > 0)
+    CPU_RELAX();
+
+  unsigned int active = 0;
+  for (unsigned int i = 0; i < m_numThreads; i++) {
+    Participant& p = m_participants[i];
+    if (p.usedJob.load() != job)
+      continue;
+    for (unsigned int f = 0; f < nFrames; f++)
+      out[f * stride] += p.buffer[f];
+    active += p.active;
+  }
+  m_bank->endBuffer();
+
+  // Late workers would make the next buffers late too, so stay serial a while
+  if (Clock::now() > deadline) {
+    m_serialBuffers.store(RENDER_FALLBACK_BUFFERS);
+    m_numMissed++;
+  }
+
+  return active;
+}
+
+unsigned int RenderPool::renderSerial(const std::vector<SoundSource*>& sources,
+                                      SAMPLE* out, unsigned int nFrames, unsigned int stride)
+{
+  m_bank->tick(out, nFrames, stride);
+
+  unsigned int active = 0;
+  for (size_t i = 0; i < sources.size(); i++) {
+    SoundSource* source = sources[i];
+    if (source->isSleeping())
+      continue;
+    source->tick(out, nFrames, stride);
+    active++;
+  }
+  return active;
+}
+
+void RenderPool::wakeWorkers()
+{
+  for (unsigned int i = 1; i < m_numThreads; i++) {
+    Participant& p = m_participants[i];
+    if (p.fSleeping.exchange(false))
+      sem_post(&p.wake);
+  }
+}
+
+void RenderPool::runJob(Participant* self, unsigned int job)
+{
+  m_inFlight++;
+
+  unsigned int task;
+  while (takeTask(self, job, task)) {
+    if (self->usedJob.load() != job) {
+      memset(self->mix, 0, m_nFrames * StringBank::getLanes() * sizeof(float));
+      memset(self->buffer, 0, m_nFrames * sizeof(SAMPLE));
+      self->active = 0;
+      self->usedJob.store(job);
+    }
+    renderTask(self, job, task);
+  }
+
+  if (self->usedJob.load() == job)
+    m_bank->mixDown(self->mix, self->buffer, m_nFrames, 1);
+
+  m_inFlight--;
+}
+
+bool RenderPool::takeTask(Participant* self, unsigned int job, unsigned int& task)
+{
+  // Own tasks come off the front
+  unsigned long long tasks = self->tasks.load();
+  while (taskJob(tasks) == job && taskFirst(tasks) < taskLast(tasks)) {
+    if (self->tasks.compare_exchange_weak(tasks, packTasks(job, taskFirst(tasks) + 1, taskLast(tasks)))) {
+      task = taskFirst(tasks);
+      return true;
+    }
+  }
+
+  // Others' come off the back, away from where their owners are working
+  for (unsigned int i = 1; i < m_numThreads; i++) {
+    Participant& victim = m_participants[(self->index + i) % m_numThreads];
+    tasks = victim.tasks.load();
+    while (taskJob(tasks) == job && taskFirst(tasks) < taskLast(tasks)) {
+      if (victim.tasks.compare_exchange_weak(tasks, packTasks(job, taskFirst(tasks), taskLast(tasks) - 1))) {
+        task = taskLast(tasks) - 1;
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+void RenderPool::renderTask(Participant* self, unsigned int job, unsigned int task)
+{
+  if (task < m_numGroupTasks) {
+    unsigned int first = task * RENDER_GROUPS_PER_TASK;
+    m_bank->renderGroups(first, std::min(first + RENDER_GROUPS_PER_TASK, m_numGroups), self->mix);
+    return;
+  }
+
+  const std::vector<SoundSource*>& sources = *m_sources;
+  unsigned int first = (task - m_numGroupTasks) * RENDER_SOURCES_PER_TASK;
+  unsigned int last = std::min(first + RENDER_SOURCES_PER_TASK, (unsigned int)sources.size());
+  for (unsigned int i = first; i < last; i++) {
+    if (sources[i]->isSleeping())
+      continue;
+    sources[i]->tick(self->buffer, m_nFrames, 1);
+    self->active++;
+  }
+}
+
+void* RenderPool::work(void* participant)
+{
+  Participant* self = (Participant*)participant;
+  RenderPool* pool = self->pool;
+
+#ifdef __OS_LINUX__
+  // One worker per core, leaving the first one to the audio thread
+  long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (numCpus > 1) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(self->index % numCpus, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+      std::cerr << "[render] could not pin worker " << self->index << std::endl;
+  }
+#endif
+
+  while (true) {
+    // Jobs come every buffer, so spin a little before going to sleep
+    unsigned int job = pool->m_job.load();
+    for (unsigned int i = 0; i < RENDER_WORKER_SPIN && job == self->seenJob && !pool->m_fQuit.load(); i++)
+      job = pool->m_job.load();
+
+    // Say so before looking once more, so that a job published in between
+    // is either seen here or followed by a post
+    while (job == self->seenJob && !pool->m_fQuit.load()) {
+      self->fSleeping.store(true);
+      job = pool->m_job.load();
+      if ((job != self->seenJob || pool->m_fQuit.load()) && self->fSleeping.exchange(false))
+        break;
+
+      while (sem_wait(&self->wake) == -1 && errno == EINTR)
+        ;
+      job = pool->m_job.load();
+    }
+
+    if (pool->m_fQuit.load())
+      break;
+
+    self->seenJob = job;
+    pool->runJob(self, job);
+  }
+
+  return NULL;
+}
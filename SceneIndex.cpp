@@ -0,0 +1,151 @@
+#include <math.h>
+#include <algorithm>
+
+#include "SceneIndex.h"
+#include "Widget.h"
+
+Widget* SceneIndex::s_root = NULL;
+bool SceneIndex::s_fChanged = true;
+unsigned int SceneIndex::s_version = 0;
+std::vector<SceneIndex::Entry> SceneIndex::s_entries;
+std::vector<unsigned int> SceneIndex::s_buckets[SCENE_HASH_BUCKETS];
+std::vector<unsigned int> SceneIndex::s_unbounded;
+std::vector<unsigned int> SceneIndex::s_candidates;
+std::vector<Widget*> SceneIndex::s_hovered;
+
+static inline int getCell(float coordinate)
+{
+  return (int)floor(coordinate / SCENE_CELL_SIZE);
+}
+
+void SceneIndex::moved(const Widget* widget)
+{
+  if (widget->getSceneVersion() == s_version)
+    s_fChanged = true;
+}
+
+unsigned int SceneIndex::getBucket(int cx, int cy)
+{
+  return ((unsigned int)cx * 73856093u ^ (unsigned int)cy * 19349663u) % SCENE_HASH_BUCKETS;
+}
+
+void SceneIndex::update()
+{
+  if (!s_fChanged || !s_root)
+    return;
+  s_fChanged = false;
+  s_version++;
+
+  s_entries.clear();
+  s_unbounded.clear();
+  for (int i = 0; i < SCENE_HASH_BUCKETS; i++)
+    s_buckets[i].clear();
+  s_hovered.clear();
+
+  unsigned int z = 0;
+  collect(s_root, z);
+
+  for (unsigned int i = 0; i < s_entries.size(); i++) {
+    const Entry& entry = s_entries[i];
+    if (!entry.fBounded) {
+      s_unbounded.push_back(i);
+      continue;
+    }
+
+    // Boxes covering more cells than there are buckets are no use hashed
+    int x1 = getCell(entry.min.x), y1 = getCell(entry.min.y),
+        x2 = getCell(entry.max.x), y2 = getCell(entry.max.y);
+    if ((double)(x2 - x1 + 1) * (y2 - y1 + 1) > SCENE_HASH_BUCKETS) {
+      s_unbounded.push_back(i);
+      continue;
+    }
+
+    for (int cx = x1; cx <= x2; cx++)
+      for (int cy = y1; cy <= y2; cy++) {
+        // Cells sharing a bucket would list the entry again, right after itself
+        std::vector<unsigned int>& bucket = s_buckets[getBucket(cx, cy)];
+        if (bucket.empty() || bucket.back() != i)
+          bucket.push_back(i);
+      }
+  }
+}
+
+void SceneIndex::collect(Widget* parent, unsigned int& z)
+{
+  const std::vector<Widget*>* children = parent->getChildren();
+  for (size_t i = 0; i < children->size(); i++) {
+    Widget* child = children->at(i);
+    Entry entry;
+    entry.widget = child;
+    entry.parent = parent;
+    entry.z = z++;
+    entry.fBounded = child->getBounds(entry.min, entry.max);
+    child->setSceneVersion(s_version);
+    s_entries.push_back(entry);
+
+    // Children draw over their parent
+    collect(child, z);
+  }
+}
+
+static bool compareTopmost(const std::pair<unsigned int, unsigned int>& a,
+                           const std::pair<unsigned int, unsigned int>& b)
+{
+  return a.first > b.first;
+}
+
+void SceneIndex::findCandidates(float x, float y)
+{
+  update();
+
+  static std::vector<std::pair<unsigned int, unsigned int> > sorted; // (z, entry)
+  sorted.clear();
+
+  const std::vector<unsigned int>& bucket = s_buckets[getBucket(getCell(x), getCell(y))];
+  for (size_t i = 0; i < bucket.size(); i++) {
+    const Entry& entry = s_entries[bucket[i]];
+    if (x >= entry.min.x && x <= entry.max.x && y >= entry.min.y && y <= entry.max.y)
+      sorted.push_back(std::make_pair(entry.z, bucket[i]));
+  }
+  for (size_t i = 0; i < s_unbounded.size(); i++)
+    sorted.push_back(std::make_pair(s_entries[s_unbounded[i]].z, s_unbounded[i]));
+
+  std::sort(sorted.begin(), sorted.end(), compareTopmost);
+  s_candidates.clear();
+  for (size_t i = 0; i < sorted.size(); i++)
+    s_candidates.push_back(sorted[i].second);
+}
+
+void SceneIndex::query(float x, float y, std::vector<Widget*>& hits)
+{
+  hits.clear();
+  findCandidates(x, y);
+  for (size_t i = 0; i < s_candidates.size(); i++) {
+    Widget* widget = s_entries[s_candidates[i]].widget;
+    if (widget->hitTest(x, y) && std::find(hits.begin(), hits.end(), widget) == hits.end())
+      hits.push_back(widget);
+  }
+}
+
+Widget* SceneIndex::pickChild(Widget* parent, float x, float y)
+{
+  findCandidates(x, y);
+  for (size_t i = 0; i < s_candidates.size(); i++) {
+    const Entry& entry = s_entries[s_candidates[i]];
+    if (entry.parent == parent && entry.widget->hitTest(x, y))
+      return entry.widget;
+  }
+  return NULL;
+}
+
+void SceneIndex::updateHover(float x, float y)
+{
+  s_hovered.clear();
+  for (Widget* widget = pickChild(s_root, x, y); widget; widget = pickChild(widget, x, y))
+    s_hovered.push_back(widget);
+}
+
+bool SceneIndex::isHovered(const Widget* widget)
+{
+  return std::find(s_hovered.begin(), s_hovered.end(), widget) != s_hovered.end();
+}
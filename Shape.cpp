@@ -239,6 +239,32 @@ float Line::getParallelPosition(Point2D pos)
   return (a.x * b.x + a.y * b.y) / (amp * amp);
 }
 
+bool Line::getIntersection(Point2D from, Point2D to, float& t)
+{
+  return getIntersection(from, to, m_p1, m_p2, t);
+}
+
+bool Line::getIntersection(Point2D from, Point2D to, Point2D p1, Point2D p2, float& t)
+{
+  // from + t * d == p1 + u * e
+  float dx = to.x - from.x, dy = to.y - from.y,
+        ex = p2.x - p1.x, ey = p2.y - p1.y,
+        fx = p1.x - from.x, fy = p1.y - from.y;
+
+  // Parallel (or degenerate) segments never cross
+  float denom = dx * ey - dy * ex;
+  if (denom == 0)
+    return false;
+
+  float s = (fx * ey - fy * ex) / denom,
+        u = (fx * dy - fy * dx) / denom;
+  if (s <= 0 || s > 1 || u < 0 || u > 1)
+    return false;
+
+  t = s;
+  return true;
+}
+
 
 Text::Text(Point2D pos, std::string str) : m_pos(pos), m_str(str)
 {
@@ -267,8 +293,8 @@ int Text::getWidth()
     if (*p == '\n') {
       maxLineWidth = std::max(width, maxLineWidth);
       width = 0;
-    }
-    width += glutBitmapWidth(GLUT_BITMAP_9_BY_15, *p);
+    } else
+      width += TEXT_CHAR_WIDTH; // Monospaced, so this works without a window
   }
   maxLineWidth = std::max(width, maxLineWidth);
   return maxLineWidth;
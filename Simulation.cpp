@@ -0,0 +1,280 @@
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <iostream>
+#include <algorithm>
+
+#include "Simulation.h"
+#include "Engine.h"
+#include "Clock.h"
+#include "EventQueue.h"
+
+pthread_rwlock_t Simulation::s_sceneLock = PTHREAD_RWLOCK_INITIALIZER;
+double Simulation::s_stepTime = 0;
+
+Simulation::Simulation(Engine* engine, double rate, Mode mode) :
+  m_engine(engine),
+  m_rate(rate),
+  m_mode(mode),
+  m_fRunning(false),
+  m_tick(0),
+  m_front(0),
+  m_snapshotTime(Clock::now()),
+  m_snapshotPeriod(1 / rate)
+{
+  sem_init(&m_wake, 0, 0);
+}
+
+Simulation::~Simulation()
+{
+  stop();
+  sem_destroy(&m_wake);
+}
+
+void Simulation::start()
+{
+  if (m_fRunning.load())
+    return;
+
+  if (m_mode == EVENT_DRIVEN) {
+    lockScene();
+    TrackGraph::update(m_engine);
+    EventQueue::start(Clock::now());
+    unlockScene();
+  }
+
+  m_fRunning.store(true);
+  if (!m_thread.start(m_mode == EVENT_DRIVEN ? runEvents : run, this)) {
+    std::cerr << "Error when creating simulation thread!" << std::endl;
+    exit(1);
+  }
+}
+
+void Simulation::stop()
+{
+  if (!m_fRunning.load())
+    return;
+
+  m_fRunning.store(false);
+  sem_post(&m_wake);
+  m_thread.wait();
+}
+
+void Simulation::step()
+{
+  step(Clock::now());
+}
+
+void Simulation::step(double time)
+{
+  lockSceneShared();
+  s_stepTime = time;
+  TrackGraph::update(m_engine);
+  applyInputs();
+  m_engine->simulate(1 / m_rate);
+
+  // Then the splits, in UUID order, so that caps and merges come out the
+  // same on every peer
+  const std::vector<Track*>& tracks = TrackGraph::getTracks();
+  for (size_t i = 0; i < tracks.size(); i++)
+    tracks[i]->splitArrivals();
+
+  collect(1 / m_rate);
+  m_tick++;
+  unlockScene();
+
+  swap(time, 1 / m_rate);
+}
+
+unsigned long long Simulation::getInputTick()
+{
+  return m_tick + (unsigned long long)(LOCKSTEP_INPUT_DELAY * m_rate);
+}
+
+void Simulation::addPlucker(Track* track)
+{
+  PluckerInput input;
+  input.tick = m_tick;
+  input.track = track->getUuid();
+  m_inputs.push_back(input);
+  if (m_mode == EVENT_DRIVEN)
+    sem_post(&m_wake);
+}
+
+void Simulation::queuePlucker(Track* track, unsigned long long tick)
+{
+  // Too late to start along with the peers' copies; it will be out of step
+  if (tick < m_tick) {
+    std::cerr << "Simulation::queuePlucker: " << m_tick - tick << " steps late" << std::endl;
+    tick = m_tick;
+  }
+
+  PluckerInput input;
+  input.tick = tick;
+  input.track = track->getUuid();
+  m_inputs.push_back(input);
+}
+
+void Simulation::applyInputs()
+{
+  if (m_inputs.empty())
+    return;
+
+  std::sort(m_inputs.begin(), m_inputs.end());
+  WidgetMap* widgets = Widget::getAll();
+  size_t i = 0;
+  for (; i < m_inputs.size() && m_inputs[i].tick <= m_tick; i++) {
+    WidgetMap::iterator wit = widgets->find(m_inputs[i].track);
+    if (wit != widgets->end() && wit->second->isTrack())
+      ((Track*)wit->second)->addPlucker();
+  }
+  m_inputs.erase(m_inputs.begin(), m_inputs.begin() + i);
+}
+
+double Simulation::syncTick()
+{
+  double ticks = Clock::wallTime() * m_rate;
+  lockSceneShared();
+  m_tick = (unsigned long long)ceil(ticks);
+  unlockScene();
+  return (m_tick - ticks) / m_rate;
+}
+
+void Simulation::collect(double period)
+{
+  std::vector<PluckerState>& back = m_snapshots[1 - m_front];
+  back.clear();
+
+  const std::vector<Track*>& tracks = TrackGraph::getTracks();
+  for (size_t i = 0; i < tracks.size(); i++) {
+    Track* track = tracks[i];
+    const PluckerArrays* pluckers = track->getPluckers();
+    unsigned int n = pluckers->size();
+    if (n == 0)
+      continue;
+
+    // Stepping keeps the previous positions. Between events they are only
+    // where the pluckers were the last time the track was touched, so work
+    // them out from the speed.
+    const std::vector<Point2D>* previous = &pluckers->previousPos;
+    if (m_mode == EVENT_DRIVEN) {
+      track->syncTo(Clock::now());
+      m_s.resize(n);
+      m_positions.resize(n);
+      float ds = PLUCKER_VELOCITY * period;
+      for (unsigned int k = 0; k < n; k++)
+        m_s[k] = std::min(track->getLength(), std::max(0.f, pluckers->s[k] - pluckers->direction[k] * ds));
+      track->getPositions(&m_s[0], &m_positions[0], n);
+      previous = &m_positions;
+    }
+
+    for (unsigned int k = 0; k < n; k++)
+      back.push_back(PluckerState(previous->at(k), pluckers->pos[k]));
+  }
+}
+
+void Simulation::swap(double time, double period)
+{
+  m_snapshotMutex.lock();
+  m_front = 1 - m_front;
+  m_snapshotTime = time;
+  m_snapshotPeriod = period;
+  m_snapshotMutex.unlock();
+}
+
+void Simulation::getPluckerPositions(std::vector<Point2D>& positions)
+{
+  positions.clear();
+
+  m_snapshotMutex.lock();
+  const std::vector<PluckerState>& front = m_snapshots[m_front];
+  float alpha = std::min(1.0, std::max(0.0, (Clock::now() - m_snapshotTime) / m_snapshotPeriod));
+  for (size_t i = 0; i < front.size(); i++) {
+    const PluckerState& state = front[i];
+    positions.push_back(Point2D(state.previous.x + (state.current.x - state.previous.x) * alpha,
+                                state.previous.y + (state.current.y - state.previous.y) * alpha));
+  }
+  m_snapshotMutex.unlock();
+}
+
+void* Simulation::run(void* simulation)
+{
+  Simulation* self = (Simulation*)simulation;
+  double period = 1 / self->m_rate;
+  double next = Clock::now();
+  if (self->m_mode == LOCKSTEP)
+    next += self->syncTick();
+
+  while (self->m_fRunning.load()) {
+    double now = Clock::now();
+    if (now < next) {
+      usleep((next - now) * 1e6);
+      continue;
+    }
+
+    // Catch up on a few missed steps, but after a long stall (a blocking
+    // redraw, the machine suspending) carry on from now instead of racing
+    if (now - next > SIMULATION_MAX_LAG * period) {
+      next = now;
+      if (self->m_mode == LOCKSTEP) {
+        std::cerr << "Simulation: fell behind, out of step with the peers" << std::endl;
+        next += self->syncTick();
+      }
+    }
+
+    self->step(next);
+    next += period;
+  }
+
+  return NULL;
+}
+
+void* Simulation::runEvents(void* simulation)
+{
+  Simulation* self = (Simulation*)simulation;
+  double framePeriod = TIMER_MSECS / 1000.0;
+  double nextFrame = Clock::now();
+
+  while (self->m_fRunning.load()) {
+    lockSceneShared();
+    double now = Clock::now();
+    TrackGraph::update(self->m_engine);
+    EventQueue::update(now);
+    self->applyInputs();
+
+    // Fire a step's worth ahead, so that plucks can be queued with the
+    // delay that puts them on time
+    EventQueue::fire(now + 1 / self->m_rate);
+
+    bool fFrame = now >= nextFrame;
+    if (fFrame) {
+      self->collect(framePeriod);
+      nextFrame = now + framePeriod;
+    }
+    double next = std::min(EventQueue::getNextTime() - 1 / self->m_rate, nextFrame);
+    unlockScene();
+
+    if (fFrame)
+      self->swap(now, framePeriod);
+
+    // Sleep until then, unless a plucker is added in the meantime. The
+    // deadline is on the wall clock, so convert it.
+    now = Clock::now();
+    if (next > now) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      double wait = next - now;
+      deadline.tv_sec += (time_t)wait;
+      deadline.tv_nsec += (long)((wait - floor(wait)) * 1e9);
+      if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+      while (sem_timedwait(&self->m_wake, &deadline) == -1 && errno == EINTR)
+        ;
+    }
+  }
+
+  return NULL;
+}
@@ -0,0 +1,435 @@
+#include <string.h>
+#include <math.h>
+#include <iostream>
+
+#include "StringBank.h"
+#include "AudioStats.h"
+#include "stk/Stk.h"
+
+// ===========================================
+// Vector helpers, BANK_LANES strings per step
+// ===========================================
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define BANK_LANES 8
+typedef __m256 BankVec;
+static inline BankVec vecLoad(const float* p) { return _mm256_loadu_ps(p); }
+static inline void vecStore(float* p, BankVec v) { _mm256_storeu_ps(p, v); }
+static inline BankVec vecSet(float f) { return _mm256_set1_ps(f); }
+static inline BankVec vecAdd(BankVec a, BankVec b) { return _mm256_add_ps(a, b); }
+static inline BankVec vecSub(BankVec a, BankVec b) { return _mm256_sub_ps(a, b); }
+static inline BankVec vecMul(BankVec a, BankVec b) { return _mm256_mul_ps(a, b); }
+static inline BankVec vecMax(BankVec a, BankVec b) { return _mm256_max_ps(a, b); }
+static inline BankVec vecAbs(BankVec a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define BANK_LANES 4
+typedef __m128 BankVec;
+static inline BankVec vecLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline void vecStore(float* p, BankVec v) { _mm_storeu_ps(p, v); }
+static inline BankVec vecSet(float f) { return _mm_set1_ps(f); }
+static inline BankVec vecAdd(BankVec a, BankVec b) { return _mm_add_ps(a, b); }
+static inline BankVec vecSub(BankVec a, BankVec b) { return _mm_sub_ps(a, b); }
+static inline BankVec vecMul(BankVec a, BankVec b) { return _mm_mul_ps(a, b); }
+static inline BankVec vecMax(BankVec a, BankVec b) { return _mm_max_ps(a, b); }
+static inline BankVec vecAbs(BankVec a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+#else
+#define BANK_LANES 1
+typedef float BankVec;
+static inline BankVec vecLoad(const float* p) { return *p; }
+static inline void vecStore(float* p, BankVec v) { *p = v; }
+static inline BankVec vecSet(float f) { return f; }
+static inline BankVec vecAdd(BankVec a, BankVec b) { return a + b; }
+static inline BankVec vecSub(BankVec a, BankVec b) { return a - b; }
+static inline BankVec vecMul(BankVec a, BankVec b) { return a * b; }
+static inline BankVec vecMax(BankVec a, BankVec b) { return a > b ? a : b; }
+static inline BankVec vecAbs(BankVec a) { return fabsf(a); }
+#endif
+
+#define VOICE_INDEX_BITS 16
+#define VOICE_INDEX_MASK ((1 << VOICE_INDEX_BITS) - 1)
+
+// =========================
+// StringBank implementation
+// =========================
+
+StringBank::StringBank(unsigned int maxVoices, float lowestFrequency, unsigned int maxFrames) :
+  m_maxFrames(maxFrames),
+  m_sampleRate(stk::Stk::sampleRate()),
+  m_numAllocated(0),
+  m_highWater(0),
+  m_numAwake(0),
+  m_numPlucks(0),
+  m_nFrames(0),
+  m_tickGroups(0)
+{
+  m_maxVoices = std::min(maxVoices, (unsigned int)VOICE_INDEX_MASK);
+  m_holdFrames = SILENCE_HOLD_MSECS * m_sampleRate / 1000;
+  m_numGroups = (m_maxVoices + BANK_LANES - 1) / BANK_LANES;
+  unsigned int lanes = m_numGroups * BANK_LANES;
+
+  // Room for the longest delay plus the allpass look-ahead
+  m_length = 1;
+  while (m_length < m_sampleRate / lowestFrequency + 2)
+    m_length <<= 1;
+  m_mask = m_length - 1;
+
+  m_lines = new float[lanes * m_length];
+  m_lastOut = new float[lanes];
+  m_apInput = new float[lanes];
+  m_filterIn = new float[lanes];
+  m_loopGain = new float[lanes];
+  m_coeff = new float[lanes];
+  m_pickState = new float[lanes];
+  m_peak = new float[lanes];
+  m_inPoint = new unsigned int[lanes];
+  m_outPoint = new unsigned int[lanes];
+  m_voices = new unsigned int[lanes];
+  m_quietFrames = new unsigned int[lanes];
+  m_noise = new unsigned int[lanes];
+  m_awake = new bool[lanes];
+  m_generations = new unsigned int[lanes];
+  m_liveVoices = new std::atomic<unsigned int>[lanes];
+  m_groupAwake = new unsigned int[m_numGroups];
+  m_groupFirst = new int[m_numGroups];
+  m_groupLast = new int[m_numGroups];
+  m_mix = new float[m_maxFrames * BANK_LANES];
+
+  for (unsigned int i = 0; i < lanes; i++) {
+    resetVoice(i);
+    m_voices[i] = INVALID_VOICE;
+    m_awake[i] = false;
+    m_generations[i] = 0;
+    m_liveVoices[i].store(INVALID_VOICE);
+    m_noise[i] = 22222 + i * 7919;
+    if (i < m_maxVoices)
+      m_free.insert(i);
+  }
+  for (unsigned int g = 0; g < m_numGroups; g++) {
+    m_groupAwake[g] = 0;
+    m_groupFirst[g] = m_groupLast[g] = -1;
+  }
+}
+
+StringBank::~StringBank()
+{
+  delete[] m_lines;
+  delete[] m_lastOut;
+  delete[] m_apInput;
+  delete[] m_filterIn;
+  delete[] m_loopGain;
+  delete[] m_coeff;
+  delete[] m_pickState;
+  delete[] m_peak;
+  delete[] m_inPoint;
+  delete[] m_outPoint;
+  delete[] m_voices;
+  delete[] m_quietFrames;
+  delete[] m_noise;
+  delete[] m_awake;
+  delete[] m_generations;
+  delete[] m_liveVoices;
+  delete[] m_groupAwake;
+  delete[] m_groupFirst;
+  delete[] m_groupLast;
+  delete[] m_mix;
+}
+
+unsigned int StringBank::allocate()
+{
+  unsigned int voice = INVALID_VOICE;
+
+  m_allocMutex.lock();
+  if (!m_free.empty()) {
+    unsigned int index = *m_free.begin();
+    m_free.erase(m_free.begin());
+
+    m_generations[index] = (m_generations[index] + 1) & VOICE_INDEX_MASK;
+    voice = index | (m_generations[index] << VOICE_INDEX_BITS);
+    m_liveVoices[index].store(voice);
+    m_numAllocated++;
+    if (index >= m_highWater.load())
+      m_highWater.store(index + 1);
+  }
+  m_allocMutex.unlock();
+
+  if (voice == INVALID_VOICE)
+    std::cerr << "StringBank::allocate: out of voices" << std::endl;
+  return voice;
+}
+
+void StringBank::release(unsigned int voice)
+{
+  if (voice == INVALID_VOICE)
+    return;
+
+  unsigned int index = voice & VOICE_INDEX_MASK;
+  m_allocMutex.lock();
+  if (m_liveVoices[index].load() == voice) {
+    // The audio thread notices the handle change and silences the voice
+    m_liveVoices[index].store(INVALID_VOICE);
+    m_free.insert(index);
+    m_numAllocated--;
+  }
+  m_allocMutex.unlock();
+}
+
+void StringBank::schedulePluck(unsigned int voice, unsigned int offset, float frequency, float amplitude)
+{
+  unsigned int index = voice & VOICE_INDEX_MASK;
+  if (voice == INVALID_VOICE || m_liveVoices[index].load() != voice)
+    return;
+
+  // Too many in one buffer: the latest ones are dropped, and counted
+  if (m_numPlucks == MAX_PENDING_PLUCKS) {
+    AudioStats::recordDroppedPluck();
+    return;
+  }
+
+  Pluck& pluck = m_plucks[m_numPlucks];
+  pluck.voice = voice;
+  pluck.offset = std::min(offset, m_maxFrames - 1);
+  pluck.frequency = frequency;
+  pluck.amplitude = amplitude;
+  pluck.next = -1;
+
+  // Plucks arrive in time order, so appending keeps each chain sorted
+  unsigned int group = index / BANK_LANES;
+  if (m_groupLast[group] < 0)
+    m_groupFirst[group] = m_numPlucks;
+  else
+    m_plucks[m_groupLast[group]].next = m_numPlucks;
+  m_groupLast[group] = m_numPlucks;
+  m_numPlucks++;
+}
+
+void StringBank::tick(SAMPLE* out, unsigned int nFrames, unsigned int stride)
+{
+  unsigned int numGroups = beginBuffer(nFrames);
+  memset(m_mix, 0, m_nFrames * BANK_LANES * sizeof(float));
+  renderGroups(0, numGroups, m_mix);
+  endBuffer();
+  mixDown(m_mix, out, m_nFrames, stride);
+}
+
+unsigned int StringBank::beginBuffer(unsigned int nFrames)
+{
+  m_nFrames = std::min(nFrames, m_maxFrames);
+  m_tickGroups = (m_highWater.load() + BANK_LANES - 1) / BANK_LANES;
+  return m_tickGroups;
+}
+
+void StringBank::renderGroups(unsigned int first, unsigned int last, float* mix)
+{
+  last = std::min(last, m_tickGroups);
+  for (unsigned int group = first; group < last; group++) {
+    unsigned int base = group * BANK_LANES;
+
+    // Silence voices whose string went away
+    if (m_groupAwake[group])
+      for (unsigned int i = base; i < base + BANK_LANES; i++)
+        if (m_awake[i] && m_liveVoices[i].load() != m_voices[i]) {
+          resetVoice(i);
+          setAwake(i, false);
+        }
+
+    if (!m_groupAwake[group] && m_groupFirst[group] < 0)
+      continue;
+
+    for (unsigned int i = base; i < base + BANK_LANES; i++)
+      m_peak[i] = 0;
+
+    // Render up to each pluck, then pluck right on its frame
+    unsigned int start = 0;
+    for (int p = m_groupFirst[group]; p >= 0; p = m_plucks[p].next) {
+      unsigned int offset = std::min(m_plucks[p].offset, m_nFrames);
+      renderGroup(group, start, offset, mix);
+      applyPluck(m_plucks[p]);
+      start = std::max(start, offset);
+    }
+    m_groupFirst[group] = m_groupLast[group] = -1;
+    renderGroup(group, start, m_nFrames, mix);
+
+    // Voices that stayed inaudible long enough go to sleep
+    for (unsigned int i = base; i < base + BANK_LANES; i++) {
+      if (!m_awake[i])
+        continue;
+      if (m_peak[i] < SILENCE_THRESHOLD)
+        m_quietFrames[i] += m_nFrames;
+      else
+        m_quietFrames[i] = 0;
+      if (m_quietFrames[i] >= m_holdFrames)
+        setAwake(i, false);
+    }
+  }
+}
+
+void StringBank::endBuffer()
+{
+  m_numPlucks = 0;
+
+  unsigned int numAwake = 0;
+  for (unsigned int group = 0; group < m_tickGroups; group++)
+    numAwake += m_groupAwake[group];
+  m_numAwake = numAwake;
+}
+
+void StringBank::mixDown(const float* mix, SAMPLE* out, unsigned int nFrames, unsigned int stride)
+{
+  // One horizontal sum per frame for the whole bank
+  for (unsigned int i = 0; i < nFrames; i++) {
+    float sum = 0;
+    for (unsigned int l = 0; l < BANK_LANES; l++)
+      sum += mix[i * BANK_LANES + l];
+    out[i * stride] += sum;
+  }
+}
+
+unsigned int StringBank::getLanes()
+{
+  return BANK_LANES;
+}
+
+void StringBank::renderGroup(unsigned int group, unsigned int start, unsigned int end, float* mix)
+{
+  if (end <= start)
+    return;
+
+  unsigned int base = group * BANK_LANES;
+  BankVec lastOut = vecLoad(m_lastOut + base),
+          apInput = vecLoad(m_apInput + base),
+          filterIn = vecLoad(m_filterIn + base),
+          loopGain = vecLoad(m_loopGain + base),
+          coeff = vecLoad(m_coeff + base),
+          peak = vecLoad(m_peak + base);
+  const BankVec half = vecSet(0.5f), three = vecSet(3.0f);
+
+  float* lines[BANK_LANES];
+  unsigned int inPoint[BANK_LANES], outPoint[BANK_LANES];
+  float lane[BANK_LANES];
+  for (unsigned int l = 0; l < BANK_LANES; l++) {
+    lines[l] = m_lines + (base + l) * m_length;
+    inPoint[l] = m_inPoint[base + l];
+    outPoint[l] = m_outPoint[base + l];
+  }
+
+  for (unsigned int i = start; i < end; i++) {
+    // Loop gain and the one-zero averaging filter
+    BankVec loopIn = vecMul(lastOut, loopGain);
+    vecStore(lane, vecMul(half, vecAdd(loopIn, filterIn)));
+    filterIn = loopIn;
+
+    // Delay lines differ in length, so writes and reads go lane by lane
+    for (unsigned int l = 0; l < BANK_LANES; l++) {
+      lines[l][inPoint[l]] = lane[l];
+      inPoint[l] = (inPoint[l] + 1) & m_mask;
+      lane[l] = lines[l][outPoint[l]];
+      outPoint[l] = (outPoint[l] + 1) & m_mask;
+    }
+
+    // First order allpass for the fractional part of the delay
+    BankVec delayed = vecLoad(lane);
+    lastOut = vecAdd(vecMul(coeff, vecSub(delayed, lastOut)), apInput);
+    apInput = delayed;
+
+    peak = vecMax(peak, vecAbs(lastOut));
+    float* frame = mix + i * BANK_LANES;
+    vecStore(frame, vecAdd(vecLoad(frame), vecMul(three, lastOut)));
+  }
+
+  vecStore(m_lastOut + base, lastOut);
+  vecStore(m_apInput + base, apInput);
+  vecStore(m_filterIn + base, filterIn);
+  vecStore(m_peak + base, peak);
+  for (unsigned int l = 0; l < BANK_LANES; l++) {
+    m_inPoint[base + l] = inPoint[l];
+    m_outPoint[base + l] = outPoint[l];
+  }
+}
+
+void StringBank::applyPluck(const Pluck& pluck)
+{
+  unsigned int index = pluck.voice & VOICE_INDEX_MASK;
+  if (m_voices[index] != pluck.voice) {
+    // First pluck since the voice was handed out: start from silence
+    resetVoice(index);
+    m_voices[index] = pluck.voice;
+  }
+
+  // Plucked::setFrequency, with DelayA::setDelay
+  float frequency = std::max(pluck.frequency, 1.0f);
+  float delay = m_sampleRate / frequency - 0.5f;
+  delay = std::max(0.5f, std::min(delay, (float)m_length - 2));
+
+  float outPointer = m_inPoint[index] - delay + 1.0f;
+  while (outPointer < 0)
+    outPointer += m_length;
+  unsigned int outPoint = (unsigned int)outPointer;
+  float alpha = 1.0f + outPoint - outPointer;
+  if (alpha < 0.5f) {
+    outPoint++;
+    alpha += 1.0f;
+  }
+  m_outPoint[index] = outPoint & m_mask;
+  m_coeff[index] = (1.0f - alpha) / (1.0f + alpha);
+
+  m_loopGain[index] = 0.995f + frequency * 0.000005f;
+  if (m_loopGain[index] >= 1.0f)
+    m_loopGain[index] = 0.99999f;
+
+  // Plucked::pluck: fill the line with filtered noise on top of what's there
+  float pole = 0.999f - pluck.amplitude * 0.15f,
+        b0 = pole > 0 ? 1.0f - pole : 1.0f + pole,
+        gain = pluck.amplitude * 0.5f;
+  for (unsigned int i = 0; i < delay; i++) {
+    m_pickState[index] = b0 * gain * nextNoise(index) + pole * m_pickState[index];
+    stepDelay(index, 0.6f * m_lastOut[index] + m_pickState[index]);
+  }
+
+  m_quietFrames[index] = 0;
+  setAwake(index, true);
+}
+
+void StringBank::stepDelay(unsigned int index, float input)
+{
+  float* line = m_lines + index * m_length;
+  line[m_inPoint[index]] = input;
+  m_inPoint[index] = (m_inPoint[index] + 1) & m_mask;
+
+  float delayed = line[m_outPoint[index]];
+  m_outPoint[index] = (m_outPoint[index] + 1) & m_mask;
+  m_lastOut[index] = m_coeff[index] * (delayed - m_lastOut[index]) + m_apInput[index];
+  m_apInput[index] = delayed;
+}
+
+void StringBank::resetVoice(unsigned int index)
+{
+  memset(m_lines + index * m_length, 0, m_length * sizeof(float));
+  m_lastOut[index] = m_apInput[index] = m_filterIn[index] = 0;
+  m_pickState[index] = m_peak[index] = 0;
+  m_loopGain[index] = 0;
+  m_coeff[index] = 0;
+  m_inPoint[index] = m_outPoint[index] = 0;
+  m_quietFrames[index] = 0;
+}
+
+void StringBank::setAwake(unsigned int index, bool fAwake)
+{
+  if (m_awake[index] == fAwake)
+    return;
+
+  // Only the group's count changes here; endBuffer adds them up
+  m_awake[index] = fAwake;
+  if (fAwake)
+    m_groupAwake[index / BANK_LANES]++;
+  else
+    m_groupAwake[index / BANK_LANES]--;
+}
+
+float StringBank::nextNoise(unsigned int index)
+{
+  // Numerical Recipes LCG
+  m_noise[index] = m_noise[index] * 1664525u + 1013904223u;
+  return (m_noise[index] >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
@@ -0,0 +1,140 @@
+#include <math.h>
+
+#include "StringIndex.h"
+#include "Widget.h"
+#include "Shape.h"
+
+// Increases with the angle like atan2, from 0 up to 4, but without the trig
+static inline float getPseudoAngle(float dx, float dy)
+{
+  float p = dx / (fabs(dx) + fabs(dy));
+  return dy < 0 ? 3 + p : 1 - p;
+}
+
+static inline unsigned int getBin(float pseudoAngle)
+{
+  unsigned int bin = pseudoAngle * (STRING_INDEX_BINS / 4.f);
+  return bin < STRING_INDEX_BINS ? bin : STRING_INDEX_BINS - 1;
+}
+
+unsigned int StringIndex::s_version = 0;
+
+StringIndex::StringIndex(Point2D center) :
+  m_center(center),
+  m_numStrings(0)
+{
+}
+
+bool StringIndex::getBins(Point2D p1, Point2D p2, unsigned int& first, unsigned int& last)
+{
+  float ax = p1.x - m_center.x, ay = p1.y - m_center.y,
+        ex = p2.x - p1.x, ey = p2.y - p1.y;
+
+  // Squared distance from the center to the closest point of the segment
+  float length2 = ex * ex + ey * ey;
+  float u = length2 > 0 ? -(ax * ex + ay * ey) / length2 : 0;
+  u = u < 0 ? 0 : (u > 1 ? 1 : u);
+  float cx = ax + u * ex, cy = ay + u * ey;
+  if (cx * cx + cy * cy < STRING_INDEX_CENTER * STRING_INDEX_CENTER)
+    return false;
+
+  // Away from the center a segment spans less than half a turn
+  float a1 = getPseudoAngle(ax, ay),
+        a2 = getPseudoAngle(ax + ex, ay + ey);
+  float lo = a1 < a2 ? a1 : a2,
+        hi = a1 < a2 ? a2 : a1;
+  if (hi - lo <= 2) {
+    first = getBin(lo);
+    last = getBin(hi);
+  } else {
+    first = getBin(hi);
+    last = getBin(lo);
+  }
+  return true;
+}
+
+void StringIndex::insert(String* string)
+{
+  Entry entry;
+  entry.string = string;
+  entry.slot = string->getSlot();
+  entry.p1 = string->getLine()->getP1();
+  entry.p2 = string->getLine()->getP2();
+
+  unsigned int first, last;
+  if (!getBins(entry.p1, entry.p2, first, last))
+    m_central.push_back(entry);
+  else
+    for (unsigned int bin = first; ; bin = (bin + 1) % STRING_INDEX_BINS) {
+      m_bins[bin].push_back(entry);
+      if (bin == last)
+        break;
+    }
+
+  if (m_found.size() <= entry.slot / 32)
+    m_found.resize(entry.slot / 32 + 1, 0);
+  m_numStrings++;
+  s_version++;
+}
+
+void StringIndex::remove(String* string)
+{
+  bool fFound = false;
+  for (unsigned int bin = 0; bin <= STRING_INDEX_BINS; bin++) {
+    std::vector<Entry>& entries = bin < STRING_INDEX_BINS ? m_bins[bin] : m_central;
+    for (size_t i = 0; i < entries.size(); i++)
+      if (entries[i].string == string) {
+        entries.erase(entries.begin() + i);
+        fFound = true;
+        break;
+      }
+  }
+
+  if (fFound) {
+    m_numStrings--;
+    s_version++;
+  }
+}
+
+void StringIndex::findCrossings(Point2D from, Point2D to, std::vector<StringCrossing>& crossings)
+{
+  size_t start = crossings.size();
+
+  unsigned int first, last;
+  if (!getBins(from, to, first, last)) {
+    first = 0;
+    last = STRING_INDEX_BINS - 1;
+  }
+  for (unsigned int bin = first; ; bin = (bin + 1) % STRING_INDEX_BINS) {
+    findCrossings(m_bins[bin], from, to, crossings);
+    if (bin == last)
+      break;
+  }
+  findCrossings(m_central, from, to, crossings);
+
+  for (size_t i = start; i < crossings.size(); i++) {
+    unsigned int slot = crossings[i].string->getSlot();
+    m_found[slot / 32] &= ~(1u << (slot % 32));
+  }
+}
+
+void StringIndex::findCrossings(const std::vector<Entry>& entries, Point2D from, Point2D to,
+                                std::vector<StringCrossing>& crossings)
+{
+  for (size_t i = 0; i < entries.size(); i++) {
+    const Entry& entry = entries[i];
+    StringCrossing crossing;
+    if (!Line::getIntersection(from, to, entry.p1, entry.p2, crossing.t))
+      continue;
+
+    // A string spanning several of the bins looked at shows up once per bin
+    unsigned int& word = m_found[entry.slot / 32];
+    unsigned int bit = 1u << (entry.slot % 32);
+    if (word & bit)
+      continue;
+    word |= bit;
+
+    crossing.string = entry.string;
+    crossings.push_back(crossing);
+  }
+}
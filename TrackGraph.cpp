@@ -0,0 +1,96 @@
+#include <string.h>
+#include <algorithm>
+
+#include "TrackGraph.h"
+#include "Widget.h"
+
+static bool compareUuids(Track* a, Track* b)
+{
+  return strcmp(a->getUuid(), b->getUuid()) < 0;
+}
+
+bool TrackGraph::s_fChanged = true;
+unsigned int TrackGraph::s_version = 0;
+std::vector<Track*> TrackGraph::s_tracks;
+std::vector<unsigned int> TrackGraph::s_offsets(1, 0);
+std::vector<TrackGraph::Route> TrackGraph::s_routes;
+
+void TrackGraph::update(Widget* root)
+{
+  if (!s_fChanged)
+    return;
+  s_fChanged = false;
+  s_version++;
+
+  s_tracks.clear();
+  collectTracks(root);
+  std::sort(s_tracks.begin(), s_tracks.end(), compareUuids);
+  for (size_t i = 0; i < s_tracks.size(); i++)
+    s_tracks[i]->setGraphIndex(s_version, i);
+
+  s_offsets.clear();
+  s_routes.clear();
+  s_offsets.push_back(0);
+  for (size_t i = 0; i < s_tracks.size(); i++)
+    for (int end = 0; end < 2; end++) {
+      Track* from = s_tracks[i];
+      Joint* joint = end == 0 ? from->getJoint1() : from->getJoint2();
+      const std::vector<Track*>& tracks = *joint->getTracks();
+
+      // Carry on along other tracks that are finished drawing, are still in
+      // the scene, and if directed start here
+      for (size_t j = 0; j < tracks.size(); j++) {
+        Track* to = tracks[j];
+        if (to == from || !to->isEnabled() || !to->isInGraph(s_version) ||
+            (to->isDirected() && to->getJoint1() != joint))
+          continue;
+
+        Route route;
+        route.track = to;
+        route.startJoint = joint;
+        route.endJoint = to->getJoint1() == joint ? to->getJoint2() : to->getJoint1();
+        s_routes.push_back(route);
+      }
+      s_offsets.push_back(s_routes.size());
+    }
+}
+
+void TrackGraph::invalidate(Widget* widget)
+{
+  if (!s_fChanged && hasTracks(widget))
+    invalidate();
+}
+
+void TrackGraph::getRoutes(Track* track, bool fAtJoint1, const Route*& first, const Route*& last)
+{
+  if (!track->isInGraph(s_version) || s_routes.empty()) {
+    first = last = NULL;
+    return;
+  }
+
+  unsigned int i = track->getGraphIndex() * 2 + (fAtJoint1 ? 0 : 1);
+  first = &s_routes[0] + s_offsets[i];
+  last = &s_routes[0] + s_offsets[i + 1];
+}
+
+void TrackGraph::collectTracks(Widget* widget)
+{
+  const std::vector<Widget*>* children = widget->getChildren();
+  for (size_t i = 0; i < children->size(); i++) {
+    if (children->at(i)->isTrack())
+      s_tracks.push_back((Track*)children->at(i));
+    else
+      collectTracks(children->at(i));
+  }
+}
+
+bool TrackGraph::hasTracks(Widget* widget)
+{
+  if (widget->isTrack())
+    return true;
+  const std::vector<Widget*>* children = widget->getChildren();
+  for (size_t i = 0; i < children->size(); i++)
+    if (hasTracks(children->at(i)))
+      return true;
+  return false;
+}
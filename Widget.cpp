@@ -4,7 +4,9 @@
 #include <string.h>
 #include <sstream>
 #include <time.h>
+#include <unistd.h>
 #include <algorithm>
+#include <float.h>
 
 #ifdef __MACOSX_CORE__
 #include <GLUT/glut.h>
@@ -22,35 +24,245 @@
 #include "Widget.h"
 #include "Engine.h"
 #include "Network.h"
+#include "Clock.h"
+#include "Simulation.h"
 
 // Widget globals
 WidgetMap g_widgets;
 WidgetMap* Widget::getAll() { return &g_widgets; }
 
-SoundSourceMap g_soundSources1, g_soundSources2;
+// Sound source globals
+//
+// The engine side set is only touched by the GUI and network threads. Each
+// change is published to the audio thread as a fresh immutable list through
+// an atomic pointer. The audio thread bumps s_audioEpoch on entering and on
+// leaving a buffer, so a retired list can be freed once the epoch was even
+// (no buffer in flight) or has moved on since the list was swapped out.
+SoundSourceMap SoundSource::s_forEngine;
+bool SoundSource::s_fDirty = false;
+unsigned long SoundSource::s_version = 0;
+std::vector<std::pair<SoundSourceList*, unsigned long> > SoundSource::s_retired;
+stk::Mutex SoundSource::s_engineMutex;
+std::atomic<SoundSourceList*> SoundSource::s_forAudio(NULL);
+std::atomic<unsigned long> SoundSource::s_audioEpoch(0);
+std::atomic<unsigned int> SoundSource::s_activeVoices(0), SoundSource::s_totalVoices(0);
+
+// Pluck events and the stream clock they are stamped against
+std::atomic<unsigned int> SoundSource::s_nextSourceId(1);
+PluckQueue SoundSource::s_plucks(PLUCK_QUEUE_SIZE);
+PluckEvent SoundSource::s_pendingPlucks[MAX_PENDING_PLUCKS];
+unsigned int SoundSource::s_numPendingPlucks = 0;
+std::atomic<unsigned int> SoundSource::s_clockSeq(0);
+std::atomic<unsigned long long> SoundSource::s_clockFrame(0);
+std::atomic<double> SoundSource::s_clockTime(0);
+std::atomic<unsigned int> SoundSource::s_clockBufferSize(0);
+unsigned long long SoundSource::s_nextFrame = 0;
+bool SoundSource::s_fRealtimeClock = true;
+
+SoundSource::SoundSource() :
+  m_sourceId(s_nextSourceId++)
+{
+}
+
+static bool compareSourceIds(const SoundSource* a, const SoundSource* b)
+{
+  return a->getSourceId() < b->getSourceId();
+}
+
+static bool isBeforeSourceId(const SoundSource* a, unsigned int id)
+{
+  return a->getSourceId() < id;
+}
+
 void SoundSource::initializeGlobals() {
-  s_forAudio = &g_soundSources1;
-  s_forEngine = &g_soundSources2;
+  s_clockTime.store(Clock::now());
+
+  s_engineMutex.lock();
+  {
+    s_fDirty = true;
+    publishLocked();
+  }
+  s_engineMutex.unlock();
+}
+
+void SoundSource::addGlobal(SoundSource* source) {
+  s_engineMutex.lock();
+  {
+    s_forEngine.insert(SoundSourceData(source->getUuid(), source));
+    s_fDirty = true;
+  }
+  s_engineMutex.unlock();
 }
-void SoundSource::lockGlobals() { s_swapMutex.lock(); }
-void SoundSource::unlockGlobals() { s_swapMutex.unlock(); }
-void SoundSource::swapGlobals() {
-  SoundSourceMap* tmp = s_forAudio;
 
-  s_swapMutex.lock();
+void SoundSource::removeGlobal(SoundSource* source) {
+  s_engineMutex.lock();
   {
-    s_forAudio = s_forEngine;
-    s_forEngine = tmp;
+    SoundSourceMap::iterator sit = s_forEngine.find(source->getUuid());
+    if (sit != s_forEngine.end() && sit->second == source) {
+      s_forEngine.erase(sit);
+      s_fDirty = true;
+
+      // Strings are reached through their bank voice, never in place, so
+      // the old lists can go at the next publishGlobals(). Sources rendered
+      // in place are about to be freed, and can't wait that long.
+      if (source->isRendered()) {
+        publishLocked();
+        reclaimLocked(true);
+      }
+    }
+  }
+  s_engineMutex.unlock();
+}
+
+bool SoundSource::hasGlobal(const std::string& uuid) {
+  bool found;
+  s_engineMutex.lock();
+  {
+    found = s_forEngine.find(uuid) != s_forEngine.end();
+  }
+  s_engineMutex.unlock();
+  return found;
+}
+
+void SoundSource::publishGlobals() {
+  s_engineMutex.lock();
+  {
+    publishLocked();
+    reclaimLocked(false);
+  }
+  s_engineMutex.unlock();
+}
+
+void SoundSource::publishLocked() {
+  if (!s_fDirty)
+    return;
+
+  SoundSourceList* list = new SoundSourceList();
+  list->version = ++s_version;
+  for (SoundSourceMap::iterator sit = s_forEngine.begin(); sit != s_forEngine.end(); sit++)
+    if (sit->second->isRendered())
+      list->rendered.push_back(sit->second);
+  list->sources = list->rendered;
+  // Sorted by id so the audio thread can look up pluck targets
+  std::sort(list->sources.begin(), list->sources.end(), compareSourceIds);
+
+  SoundSourceList* old = s_forAudio.exchange(list);
+  if (old)
+    s_retired.push_back(std::make_pair(old, s_audioEpoch.load()));
+  s_fDirty = false;
+}
+
+void SoundSource::reclaimLocked(bool wait) {
+  std::vector<std::pair<SoundSourceList*, unsigned long> >::iterator rit = s_retired.begin();
+  while (rit != s_retired.end()) {
+    if (wait)
+      while (rit->second % 2 == 1 && s_audioEpoch.load() == rit->second)
+        usleep(500);
+
+    if (rit->second % 2 == 0 || s_audioEpoch.load() != rit->second) {
+      delete rit->first;
+      rit = s_retired.erase(rit);
+    } else
+      rit++;
+  }
+}
+
+const SoundSourceList* SoundSource::acquireForAudio() {
+  s_audioEpoch.fetch_add(1);
+  return s_forAudio.load();
+}
+
+void SoundSource::releaseForAudio() {
+  s_audioEpoch.fetch_add(1);
+}
+
+void SoundSource::setVoiceCounts(unsigned int active, unsigned int total) {
+  s_activeVoices.store(active);
+  s_totalVoices.store(total);
+}
+
+unsigned long long SoundSource::advanceClock(unsigned int nFrames) {
+  unsigned long long frame = s_nextFrame;
+  s_nextFrame += nFrames;
+
+  s_clockSeq.fetch_add(1);
+  s_clockFrame.store(frame);
+  s_clockTime.store(Clock::now());
+  s_clockBufferSize.store(nFrames);
+  s_clockSeq.fetch_add(1);
+
+  return frame;
+}
+
+double SoundSource::getPluckFrame(double pluckTime) {
+  unsigned int seq, bufferSize;
+  unsigned long long frame;
+  double time;
+
+  do {
+    seq = s_clockSeq.load();
+    frame = s_clockFrame.load();
+    time = s_clockTime.load();
+    bufferSize = s_clockBufferSize.load();
+  } while (seq % 2 == 1 || seq != s_clockSeq.load());
+
+  // Offline, the times are only good relative to now
+  if (!s_fRealtimeClock)
+    return frame + bufferSize + (pluckTime - Clock::now()) * stk::Stk::sampleRate();
+
+  // Extrapolate from the start of the buffer being rendered, and land one
+  // buffer later so the pluck keeps its position within a future buffer
+  return frame + (pluckTime - time) * stk::Stk::sampleRate() + bufferSize;
+}
+
+void SoundSource::queuePluck(const PluckEvent& event) {
+  if (!s_plucks.push(event))
+    std::cerr << "SoundSource::queuePluck: queue full, dropping pluck" << std::endl;
+}
+
+void SoundSource::dispatchPlucks(const SoundSourceList* list,
+                                 unsigned long long frame, unsigned int nFrames) {
+  PluckEvent event;
+  while (s_numPendingPlucks < MAX_PENDING_PLUCKS && s_plucks.pop(event)) {
+    // Insertion sort by frame; arrivals are almost always in order already
+    unsigned int i = s_numPendingPlucks++;
+    for (; i > 0 && s_pendingPlucks[i - 1].frame > event.frame; i--)
+      s_pendingPlucks[i] = s_pendingPlucks[i - 1];
+    s_pendingPlucks[i] = event;
   }
-  s_swapMutex.unlock();
 
-  s_forEngine->clear();
-  s_forEngine->insert(s_forAudio->begin(), s_forAudio->end());
+  double end = frame + nFrames,
+         expiry = frame - PLUCK_EXPIRY_MSECS * stk::Stk::sampleRate() / 1000.;
+  unsigned int kept = 0;
+  for (unsigned int i = 0; i < s_numPendingPlucks; i++) {
+    event = s_pendingPlucks[i];
+    if (event.frame >= end) {
+      s_pendingPlucks[kept++] = event;
+      continue;
+    }
+
+    // The bank drops plucks for voices released since
+    unsigned int offset = event.frame <= frame ? 0 : (unsigned int)(event.frame - frame);
+    if (event.voice != StringBank::INVALID_VOICE) {
+      String::getBank()->schedulePluck(event.voice, offset, event.frequency, event.amplitude);
+      continue;
+    }
+
+    std::vector<SoundSource*>::const_iterator sit =
+      std::lower_bound(list->sources.begin(), list->sources.end(), event.sourceId, isBeforeSourceId);
+    if (sit != list->sources.end() && (*sit)->getSourceId() == event.sourceId)
+      (*sit)->schedulePluck(event, offset);
+    else if (event.frame >= expiry)
+      s_pendingPlucks[kept++] = event; // Not published yet, so hold on to it
+  }
+  s_numPendingPlucks = kept;
+}
+
+void SoundSource::tick(SAMPLE* out, unsigned int nFrames, unsigned int stride)
+{
+  for (unsigned int i = 0; i < nFrames; i++)
+    out[i * stride] += tick();
 }
-SoundSourceMap* SoundSource::getAllForAudio() { return s_forAudio; }
-SoundSourceMap* SoundSource::getAllForEngine() { return s_forEngine; }
-SoundSourceMap* SoundSource::s_forAudio, *SoundSource::s_forEngine;
-stk::Mutex SoundSource::s_swapMutex;
 
 // Widget statics
 Network* Widget::s_network;
@@ -62,16 +274,14 @@ Network* Widget::s_network;
 Widget::Widget() :
     m_fLeftButtonDown(false),
     m_fRightButtonDown(false),
-    m_mouseDownOn(NULL),
     m_parent(NULL),
     m_engine(NULL),
-    m_uuid("")
+    m_uuid(""),
+    m_sceneVersion(0),
+    m_type(WIDGET_OTHER),
+    m_prevOfType(NULL),
+    m_nextOfType(NULL)
 {
-  uuid_t uuid;
-  uuid_generate(uuid);
-  char s[37];
-  uuid_unparse(uuid, s);
-  setUuid(s);
 }
 
 Widget::~Widget() {
@@ -81,7 +291,9 @@ Widget::~Widget() {
     delete *cit;
   m_children.clear();
 
-  g_widgets.erase(m_uuid);
+  if (!m_uuid.empty())
+    g_widgets.erase(m_uuid);
+  WidgetRegistry::remove(this);
 }
 
 void Widget::setUuid(const char* uuid)
@@ -91,6 +303,13 @@ void Widget::setUuid(const char* uuid)
 
 const char* Widget::getUuid() const
 {
+  if (m_uuid.empty()) {
+    uuid_t uuid;
+    uuid_generate(uuid);
+    char s[37];
+    uuid_unparse(uuid, s);
+    m_uuid = s;
+  }
   return m_uuid.c_str();
 }
 
@@ -98,6 +317,8 @@ void Widget::addChild(Widget* child)
 {
   child->setParent(this);
   m_children.push_back(child);
+  TrackGraph::invalidate(child);
+  SceneIndex::invalidate();
 }
 
 Widget* Widget::removeChild(Widget* child)
@@ -105,6 +326,8 @@ Widget* Widget::removeChild(Widget* child)
   for (std::vector<Widget*>::iterator wit = m_children.begin(); wit != m_children.end(); wit++)
     if (*wit == child) {
       m_children.erase(wit);
+      TrackGraph::invalidate(child);
+      SceneIndex::invalidate();
       return child;
     }
   return NULL;
@@ -116,22 +339,18 @@ bool Widget::onMouseDown(int button, float x, float y)
     m_mouseDownPos = Point2D(x, y);
     m_fLeftButtonDown = true;
 
-    for (int i = m_children.size() - 1; i >= 0; i--)
-      if (m_children[i]->hitTest(x, y)) {
-        m_mouseDownOn = m_children[i];
-        m_mouseDownOn->onMouseDown(button, x, y);
-        break;
-      }
+    Widget* hit = SceneIndex::pickChild(this, x, y);
+    m_mouseDownOn = WidgetRegistry::getHandle(hit);
+    if (hit)
+      hit->onMouseDown(button, x, y);
   } else if (button == GLUT_RIGHT_BUTTON) {
     m_mouseDownPos = Point2D(x, y);
     m_fRightButtonDown = true;
 
-    for (int i = m_children.size() - 1; i >= 0; i--)
-      if (m_children[i]->hitTest(x, y)) {
-        m_mouseDownOn = m_children[i];
-        m_mouseDownOn->onMouseDown(button, x, y);
-        break;
-      }
+    Widget* hit = SceneIndex::pickChild(this, x, y);
+    m_mouseDownOn = WidgetRegistry::getHandle(hit);
+    if (hit)
+      hit->onMouseDown(button, x, y);
   }
 
   return true;
@@ -141,16 +360,14 @@ bool Widget::onMouseUp(int button, float x, float y)
 {
   if ((m_fLeftButtonDown && button == GLUT_LEFT_BUTTON) ||
       (m_fRightButtonDown && button == GLUT_RIGHT_BUTTON)) {
-    for (int i = m_children.size() - 1; i >= 0; i--)
-      if (m_children[i]->hitTest(x, y) && m_children[i] == m_mouseDownOn) {
-        m_children[i]->handleSelect(x, y, m_fRightButtonDown);
-        break;
-      }
+    // Looked up again each time, in case it went away in the meantime
+    Widget* mouseDownOn = WidgetRegistry::get(m_mouseDownOn);
+    if (mouseDownOn && mouseDownOn->hitTest(x, y))
+      mouseDownOn->handleSelect(x, y, m_fRightButtonDown);
     this->handleDrawEnd(x, y);
-    if (m_mouseDownOn) {
-      m_mouseDownOn->onMouseUp(button, x, y);
-      m_mouseDownOn = NULL;
-    }
+    if ((mouseDownOn = WidgetRegistry::get(m_mouseDownOn)))
+      mouseDownOn->onMouseUp(button, x, y);
+    m_mouseDownOn = WidgetHandle();
     m_fLeftButtonDown = false;
     m_fRightButtonDown = false;
   }
@@ -160,16 +377,17 @@ bool Widget::onMouseUp(int button, float x, float y)
 
 bool Widget::onMouseMove(float x, float y)
 {
-  if (m_mouseDownOn) {
-    m_mouseDownOn->onMouseMove(x, y);
+  Widget* mouseDownOn = WidgetRegistry::get(m_mouseDownOn);
+  if (mouseDownOn) {
+    mouseDownOn->onMouseMove(x, y);
   } else if (m_fLeftButtonDown) {
     this->handleDraw(x, y);
   } else {
-    for (int i = m_children.size() - 1; i >= 0; i--)
-      if (m_children[i]->hitTest(x, y)) {
-        m_children[i]->onMouseOver(x, y);
-        return true;
-      }
+    Widget* hit = SceneIndex::pickChild(this, x, y);
+    if (hit) {
+      hit->onMouseOver(x, y);
+      return true;
+    }
   }
 
   return false;
@@ -178,11 +396,11 @@ bool Widget::onMouseMove(float x, float y)
 bool Widget::onMouseOver(float x, float y)
 {
   this->handleHover(x, y);
-  for (int i = m_children.size() - 1; i >= 0; i--)
-    if (m_children[i]->hitTest(x, y)) {
-      m_children[i]->onMouseOver(x, y);
-      return true;
-    }
+  Widget* hit = SceneIndex::pickChild(this, x, y);
+  if (hit) {
+    hit->onMouseOver(x, y);
+    return true;
+  }
 
   return false;
 }
@@ -193,6 +411,12 @@ void Widget::drawChildren()
     m_children[i]->draw();
 }
 
+void Widget::simulate(float dt)
+{
+  for (int i = 0; i < m_children.size(); i++)
+    m_children[i]->simulate(dt);
+}
+
 void Widget::setParent(Widget *parent)
 {
   m_parent = parent;
@@ -230,11 +454,13 @@ RoundPad::RoundPad(Point2D center, float radius) :
     m_newString(NULL),
     m_hoverLine(Point2D(0, 0), Point2D(0, 0)),
     m_dragLine(Point2D(0, 0), Point2D(0, 0)),
-    m_commentText(new Text(Point2D(-100, -100), ""))
+    m_commentText(new Text(Point2D(-100, -100), "")),
+    m_stringIndex(center)
 {
   this->setRadius(radius);
   m_hoverLine.setColor(Color(0, 0, 0));
   m_dragLine.setColor(Color(0, 0, 0));
+  WidgetRegistry::add(this, WIDGET_PAD);
 }
 
 RoundPad::~RoundPad()
@@ -247,15 +473,21 @@ RoundPad::~RoundPad()
     }
   // Special check for line track whose parent is not this round pad but has the end joint on it
   std::vector<LineTrack *> lineTracks;
-  WidgetMap *widgets = Widget::getAll();
-  for (WidgetMap::iterator it = widgets->begin(); it != widgets->end(); it ++)
+  for (Widget *w = WidgetRegistry::getFirst(WIDGET_JOINT); w; w = w->getNextOfType())
   {
-    LineTrack *lineTrack = dynamic_cast<LineTrack *>(it->second);
-    if (lineTrack && lineTrack->getParent() != this &&
-      (lineTrack->getJoint1()->getParentRoundPad() == this ||
-       lineTrack->getJoint2()->getParentRoundPad() == this))
+    Joint *joint = (Joint *)w;
+    if (joint->getParentRoundPad() != this)
+      continue;
+
+    std::vector<Track *> *tracks = joint->getTracks();
+    for (int i = 0; i < tracks->size(); i ++)
     {
-      lineTracks.push_back(lineTrack);
+      // Tracks still being drawn have no parent
+      Track *track = tracks->at(i);
+      if (track->getType() == WIDGET_LINE_TRACK && track->getParent() &&
+          track->getParent() != this &&
+          std::find(lineTracks.begin(), lineTracks.end(), track) == lineTracks.end())
+        lineTracks.push_back((LineTrack *)track);
     }
   }
   for (int i = 0; i < lineTracks.size(); i ++)
@@ -268,6 +500,7 @@ RoundPad::~RoundPad()
 
 void RoundPad::setRadius(float radius) {
   m_radius = radius;
+  SceneIndex::moved(this);
 
   // Delete old circles
   for (std::vector<Spiral*>::iterator cit = m_circles.begin();
@@ -313,7 +546,9 @@ void RoundPad::draw()
 
   drawChildren();
 
-  m_hoverLine.draw();
+  // The guide follows the pointer while it is over the pad, or dragging from it
+  if (m_fLeftButtonDown || SceneIndex::isHovered(this))
+    m_hoverLine.draw();
   m_dragLine.draw();
 
   m_commentText->draw();
@@ -326,8 +561,45 @@ Widget *RoundPad::hitTest(float x, float y)
 
   if (dist < m_radius)
     return this;
+  return NULL;
+}
 
-  m_hoverLine.setPoints(Point2D(0, 0), Point2D(0, 0));
+bool RoundPad::getBounds(Point2D& min, Point2D& max)
+{
+  min = Point2D(m_center.x - m_radius, m_center.y - m_radius);
+  max = Point2D(m_center.x + m_radius, m_center.y + m_radius);
+  return true;
+}
+
+void RoundPad::addChild(Widget* child)
+{
+  Widget::addChild(child);
+
+  if (child->getType() == WIDGET_STRING)
+    m_stringIndex.insert((String*)child);
+}
+
+Widget* RoundPad::removeChild(Widget* child)
+{
+  if (child->getType() == WIDGET_STRING)
+    m_stringIndex.remove((String*)child);
+
+  return Widget::removeChild(child);
+}
+
+Joint* RoundPad::findJoint(Point2D p, const Joint* except)
+{
+  static std::vector<Joint*> joints;
+  JointIndex::findAll(p, JOINT_RADIUS, joints);
+  for (size_t i = 0; i < joints.size(); i++) {
+    if (joints[i] == except)
+      continue;
+
+    std::vector<Track*>* tracks = joints[i]->getTracks();
+    for (size_t j = 0; j < tracks->size(); j++)
+      if (tracks->at(j)->getParent() == this)
+        return joints[i];
+  }
   return NULL;
 }
 
@@ -335,7 +607,7 @@ void RoundPad::toOutboundPacketStream(osc::OutboundPacketStream& ps) const
 {
   ps.Clear();
   ps << osc::BeginMessage("/object/pad")
-     << osc::Symbol(m_uuid.c_str()) << m_center.x << m_center.y << m_radius
+     << osc::Symbol(getUuid()) << m_center.x << m_center.y << m_radius
      << osc::EndMessage;
 }
 
@@ -363,7 +635,7 @@ bool RoundPad::handleDraw(float x, float y)
       m_newString->initialize(m_mouseDownPos, endPoint, m_radius);
     else {
       m_newString = new String(m_mouseDownPos, endPoint, m_radius);
-      SoundSource::getAllForEngine()->insert(SoundSourceData(m_newString->getUuid(), m_newString));
+      SoundSource::addGlobal(m_newString);
     }
 
     if (m_newSpiralTrack) {
@@ -375,24 +647,7 @@ bool RoundPad::handleDraw(float x, float y)
     float endAngle = Spiral::getAngle(m_center, pos);
     float startRadius = Point2D::distance(m_center, m_mouseDownPos);
     float endRadius = std::min(m_radius, Point2D::distance(m_center, pos));
-    Joint *endJoint = NULL;
-
-    for (int i = m_children.size() - 1; i >= 0; i --) {
-      Track *track = dynamic_cast<Track *>(m_children[i]);
-      if (track) {
-        Joint *joint = track->getJoint1();
-        if (joint && joint->hitTest(x, y)) {
-          endJoint = joint;
-          break;
-        }
-
-        joint = track->getJoint2();
-        if (joint && joint->hitTest(x, y)) {
-          endJoint = joint;
-          break;
-        }
-      }
-    }
+    Joint *endJoint = findJoint(pos);
 
     if (m_newSpiralTrack)
       m_newSpiralTrack->initialize(m_center, startAngle, startRadius, endAngle, endRadius, NULL, endJoint);
@@ -440,13 +695,7 @@ bool RoundPad::handleHover(float x, float y)
   Color color = Color(0, 0, 0, 1);
   if (Point2D::distance(m_center, Point2D(x, y)) <= 10) {
     m_hoverLine.setPoints(Point2D(0, 0), Point2D(0, 0));
-    bool childHovered = false;
-    for (int i = m_children.size() - 1; i >= 0; i--)
-      if (m_children[i]->hitTest(x, y)) {
-        childHovered = true;
-        break;
-      }
-    if (!childHovered) {
+    if (!SceneIndex::pickChild(this, x, y)) {
       ((Engine*)getEngine())->setSelectedWidget(this);
       color = Color(1, .5, 0, 1);
     }
@@ -479,21 +728,24 @@ void RoundPad::appendCommentText(std::string comment)
 Joint::Joint(Point2D center, float radius) :
     m_center(center),
     m_radius(radius),
+    m_circle(center, 360, radius, 0, radius),
     m_newSpiralTrack(NULL),
     m_newLineTrack(NULL),
     m_drawing(false),
     m_dragLine(Point2D(0, 0), Point2D(0, 0)),
-    m_parentRoundPad(NULL)
+    m_parentRoundPad(NULL),
+    m_fIndexed(false),
+    m_indexKey(0)
 {
-  m_circle = new Spiral(center, 360, radius, 0, radius);
-  m_circle->setLineWidth(3);
-  m_circle->setFilled(true);
+  m_circle.setLineWidth(3);
+  m_circle.setFilled(true);
   m_dragLine.setColor(Color(0, 0, 0));
+  WidgetRegistry::add(this, WIDGET_JOINT);
 }
 
 Joint::~Joint()
 {
-  delete m_circle;
+  JointIndex::remove(this);
 }
 
 void Joint::draw()
@@ -503,7 +755,7 @@ void Joint::draw()
     return;
 
   m_drawing = true;
-  m_circle->draw();
+  m_circle.draw();
   m_dragLine.draw();
 
   if (m_newSpiralTrack)
@@ -517,8 +769,10 @@ void Joint::draw()
 void Joint::addTrack(Track *track)
 {
   if (track)
-    if (std::find(m_tracks.begin(), m_tracks.end(), track) == m_tracks.end())
+    if (std::find(m_tracks.begin(), m_tracks.end(), track) == m_tracks.end()) {
       m_tracks.push_back(track);
+      TrackGraph::invalidate();
+    }
 }
 
 Widget *Joint::hitTest(float x, float y)
@@ -528,17 +782,26 @@ Widget *Joint::hitTest(float x, float y)
   return NULL;
 }
 
+bool Joint::getBounds(Point2D& min, Point2D& max)
+{
+  min = Point2D(m_center.x - m_radius, m_center.y - m_radius);
+  max = Point2D(m_center.x + m_radius, m_center.y + m_radius);
+  return true;
+}
+
 void Joint::setCenter(Point2D center)
 {
   //std::cerr << "Joint::setCenter" << std::endl;
   //std::cerr << m_center.x << " " << m_center.y << std::endl;
   m_center = center;
-  m_circle->setCenter(m_center);
+  m_circle.setCenter(m_center);
+  SceneIndex::moved(this);
+  JointIndex::move(this);
 }
 
 void Joint::setColor(Color color)
 {
-  m_circle->setColor(color);
+  m_circle.setColor(color);
 }
 
 bool Joint::handleDraw(float x, float y)
@@ -560,23 +823,7 @@ bool Joint::handleDraw(float x, float y)
   radius = pad->getRadius();
 
   // Find whether the position corresponds to other end point
-  Joint *endJoint = NULL;
-  WidgetMap widgets = *Widget::getAll();
-  for (WidgetMap::iterator ptr = widgets.begin(); ptr != widgets.end(); ptr ++) {
-    Track *track = dynamic_cast<Track *>(ptr->second);
-    if (track) {
-      Joint *joint = track->getJoint1();
-      if (joint && joint != this && joint->hitTest(x, y)) {
-        endJoint = joint;
-        break;
-      }
-      joint = track->getJoint2();
-      if (joint && joint != this && joint->hitTest(x, y)) {
-        endJoint = joint;
-        break;
-      }
-    }
-  }
+  Joint *endJoint = JointIndex::find(Point2D(x, y), JOINT_RADIUS, this);
 
   float angle = Spiral::getAngle(center, Point2D(x, y));
   m_dragLine.setPoints(Spiral::getPointFromRadius(center, -radius, angle),
@@ -660,9 +907,21 @@ bool Joint::handleSelect(float x, float y, bool send)
 
     // If it's the start point
     if (track->getJoint1() == this) {
-      track->addPlucker();
-      if (send)
-        s_network->sendPlucker(track);
+      // In lockstep the plucker starts a little later, at the same step everywhere
+      Simulation* simulation = ((Engine*)getEngine())->getSimulation();
+      if (simulation && simulation->isLockstep()) {
+        unsigned long long tick = simulation->getInputTick();
+        simulation->queuePlucker(track, tick);
+        if (send)
+          s_network->sendPlucker(track, tick);
+      } else {
+        if (simulation)
+          simulation->addPlucker(track);
+        else
+          track->addPlucker();
+        if (send)
+          s_network->sendPlucker(track);
+      }
     }
   }
   return true;
@@ -686,21 +945,31 @@ Track::Track() :
   m_fEnabled(true),
   m_fActive(true),
   m_fDirected(true),
-  m_fImmediate(false)
+  m_fImmediate(false),
+  m_length(0),
+  m_graphVersion(0),
+  m_graphIndex(0),
+  m_time(0),
+  m_eventSerial(0),
+  m_fCrossingsValid(false),
+  m_crossingsVersion(0)
 {
 }
 
 // Small hack to prevent a joint to be deleted in Widget::~Widget()
 Track::~Track() {
   //std::cerr << "Track::~Track" << std::endl;
+  // Tracks taken out of the scene first have invalidated it already
+  if (isInGraph(TrackGraph::getVersion()))
+    TrackGraph::invalidate();
 
   for (std::vector<Widget*>::iterator cit = m_children.begin();
        cit != m_children.end();
        cit++)
   {
-    Joint *joint = dynamic_cast<Joint *>(*cit);
-    if (joint)
+    if ((*cit)->getType() == WIDGET_JOINT)
     {
+      Joint *joint = (Joint *)*cit;
       std::vector<Track *> *tracks = joint->getTracks();
       std::vector<Track *>::iterator ptr = std::find(tracks->begin(), tracks->end(), this);
       if (ptr != tracks->end())
@@ -714,6 +983,8 @@ Track::~Track() {
   }
   m_children.clear();
 
+  Plucker::release(m_pluckers.size());
+  m_pluckers.clear();
 }
 
 void Track::detachJoint(Joint *joint)
@@ -738,6 +1009,7 @@ void Track::detachJoint(Joint *joint)
 
 void Track::setupJoints(Joint *joint1, Joint *joint2)
 {
+  TrackGraph::invalidate();
   this->detachJoint(m_joint1);
   this->detachJoint(m_joint2);
   m_joint1 = NULL;
@@ -747,14 +1019,14 @@ void Track::setupJoints(Joint *joint1, Joint *joint2)
     m_joint1 = joint1;
   else {
     // Set to origin first
-    m_joint1 = new Joint(Point2D(0, 0), 7);
+    m_joint1 = new Joint(Point2D(0, 0), JOINT_RADIUS);
     m_joint1->setColor(Color(0.2, 0.6, 0.3));
   }
 
   if (joint2)
     m_joint2 = joint2;
   else {
-      m_joint2 = new Joint(Point2D(0, 0), 7);
+      m_joint2 = new Joint(Point2D(0, 0), JOINT_RADIUS);
       m_joint2->setColor(Color(0.6, 0.2, 0.3));
   }
 
@@ -762,34 +1034,253 @@ void Track::setupJoints(Joint *joint1, Joint *joint2)
   m_joint2->addTrack(this);
   m_children.insert(m_children.begin(), m_joint2);
   m_children.insert(m_children.begin(), m_joint1);
+
+  if (m_parent) {
+    JointIndex::insert(m_joint1);
+    JointIndex::insert(m_joint2);
+  }
+}
+
+void Track::setParent(Widget *parent)
+{
+  Widget::setParent(parent);
+
+  // Tracks being drawn have no parent, and their new joints can't be
+  // snapped to yet
+  if (parent) {
+    JointIndex::insert(m_joint1);
+    JointIndex::insert(m_joint2);
+  }
 }
 
 void Track::addPlucker()
 {
-  Plucker *plucker = new Plucker(this, getJoint1(), getJoint2());
-  this->addChild(plucker);
+  addPlucker(m_joint1, 1);
 }
 
-void Track::drawChildren()
+void Track::addPlucker(Joint *startJoint, unsigned int weight)
 {
-  for (int i = 0; i < m_children.size(); i++) {
-    Plucker* plucker = dynamic_cast<Plucker*>(m_children[i]);
-    if (plucker) {
-      plucker->tick();
+  // Bring the others up to now, so that they all share one time
+  if (EventQueue::isEnabled())
+    syncTo(EventQueue::getTime());
 
-      if (plucker->isAtEnd()) {
-        std::vector<Plucker *> pluckers = plucker->split();
-        delete plucker;
-        m_children.erase(m_children.begin() + i);
-        i--;
+  float direction = startJoint == m_joint2 ? -1 : 1;
+  float s = direction > 0 ? 0 : m_length;
 
-        for (int j = 0; j < pluckers.size(); j++)
-          pluckers[j]->draw();
-      } else
-        plucker->draw();
-    } else
-      m_children[i]->draw();
+  for (unsigned int i = 0; i < m_pluckers.size(); i++)
+    if (m_pluckers.direction[i] == direction &&
+        fabs(m_pluckers.s[i] - s) < PLUCKER_MERGE_DISTANCE) {
+      m_pluckers.weight[i] += weight;
+      Plucker::countMerged();
+      return;
+    }
+
+  if (m_pluckers.size() >= Plucker::getMaxPerTrack()) {
+    Plucker::countDropped();
+    return;
+  }
+
+  if (!Plucker::reserve())
+    return;
+
+  m_pluckers.add(s, direction, weight, getPosition(s));
+  if (EventQueue::isEnabled())
+    EventQueue::schedule(this);
+}
+
+void Track::simulate(float dt)
+{
+  unsigned int n = m_pluckers.size();
+  if (n > 0) {
+    // Move them all, then look up where they all are
+    Plucker::advance(&m_pluckers.s[0], &m_pluckers.direction[0], n, PLUCKER_VELOCITY * dt, m_length);
+    m_pluckers.previousPos.swap(m_pluckers.pos);
+    getPositions(&m_pluckers.s[0], &m_pluckers.pos[0], n);
+
+    pluckStrings(dt);
+  }
+
+  Widget::simulate(dt);
+}
+
+void Track::splitArrivals()
+{
+  // Back to front, so the one moved into a removed one's place was already seen
+  for (int i = m_pluckers.size() - 1; i >= 0; i--)
+    if (m_pluckers.direction[i] > 0 ? m_pluckers.s[i] >= m_length : m_pluckers.s[i] <= 0) {
+      split(i);
+      m_pluckers.remove(i);
+      Plucker::release(1);
+    }
+}
+
+void Track::getStringIndices(StringIndex *index[2])
+{
+  // Both ends are usually on the same pad; don't pluck its strings twice
+  RoundPad *pad1 = m_joint1->getParentRoundPad(), *pad2 = m_joint2->getParentRoundPad();
+  index[0] = pad1 ? pad1->getStringIndex() : NULL;
+  index[1] = pad2 && pad2 != pad1 ? pad2->getStringIndex() : NULL;
+}
+
+void Track::pluckStrings(float dt)
+{
+  // Steps are short enough for the chord to stand in for the arc. The
+  // simulation runs a step ahead of the sound, so a string crossed at t
+  // into the step sounds t steps after the step was due. Stamping from when
+  // it was due, not when it ran, keeps steps caught up late on time.
+  static std::vector<StringCrossing> crossings; // Simulation thread only
+  double time = Simulation::getStepTime();
+
+  StringIndex *index[2];
+  getStringIndices(index);
+
+  for (unsigned int i = 0; i < m_pluckers.size(); i++) {
+    crossings.clear();
+    for (int k = 0; k < 2; k++)
+      if (index[k])
+        index[k]->findCrossings(m_pluckers.previousPos[i], m_pluckers.pos[i], crossings);
+
+    float amplitude = Plucker::getAmplitude(m_pluckers.weight[i]);
+    for (size_t j = 0; j < crossings.size(); j++)
+      crossings[j].string->pluckAt(time + crossings[j].t * dt, amplitude);
+  }
+}
+
+void Track::split(unsigned int i)
+{
+  // The routes out of the end joint were worked out when the graph changed
+  const TrackGraph::Route *route, *last;
+  TrackGraph::getRoutes(this, m_pluckers.direction[i] < 0, route, last);
+  for (; route != last; route++)
+    route->track->addPlucker(route->startJoint, m_pluckers.weight[i]);
+}
+
+void Track::invalidateCrossings()
+{
+  m_fCrossingsValid = false;
+  EventQueue::invalidate();
+}
+
+const std::vector<TrackCrossing>& Track::getCrossings()
+{
+  if (m_fCrossingsValid && m_crossingsVersion == StringIndex::getVersion())
+    return m_crossings;
+  m_fCrossingsValid = true;
+  m_crossingsVersion = StringIndex::getVersion();
+  m_crossings.clear();
+
+  StringIndex *index[2];
+  getStringIndices(index);
+  if (!index[0] && !index[1])
+    return m_crossings;
+
+  // Walk the track in chords no longer than its lookup table's
+  unsigned int numChords = std::max(1, (int)ceil(m_length / TRACK_TABLE_SPACING));
+  std::vector<float> s(numChords + 1);
+  std::vector<Point2D> points(numChords + 1);
+  for (unsigned int i = 0; i <= numChords; i++)
+    s[i] = m_length * i / numChords;
+  getPositions(&s[0], &points[0], numChords + 1);
+
+  std::vector<StringCrossing> found;
+  for (unsigned int i = 0; i < numChords; i++) {
+    found.clear();
+    for (int k = 0; k < 2; k++)
+      if (index[k])
+        index[k]->findCrossings(points[i], points[i + 1], found);
+
+    for (size_t j = 0; j < found.size(); j++) {
+      TrackCrossing crossing;
+      crossing.s = s[i] + (s[i + 1] - s[i]) * found[j].t;
+      crossing.string = found[j].string;
+      m_crossings.push_back(crossing);
+    }
+  }
+
+  std::sort(m_crossings.begin(), m_crossings.end());
+  return m_crossings;
+}
+
+void Track::syncTo(double time)
+{
+  if (time <= m_time)
+    return;
+  double start = m_time;
+  m_time = time;
+
+  unsigned int n = m_pluckers.size();
+  if (n == 0)
+    return;
+
+  static std::vector<float> from; // Only ever synced on the simulation thread
+  from.assign(m_pluckers.s.begin(), m_pluckers.s.end());
+  Plucker::advance(&m_pluckers.s[0], &m_pluckers.direction[0], n, PLUCKER_VELOCITY * (time - start), m_length);
+  m_pluckers.previousPos.swap(m_pluckers.pos);
+  getPositions(&m_pluckers.s[0], &m_pluckers.pos[0], n);
+
+  // Pluck what each one passed, (from, to] going forwards and [to, from)
+  // going backwards, so that a string is never plucked twice. Each sounds
+  // at the time it was crossed, however late the track is brought there.
+  const std::vector<TrackCrossing>& crossings = getCrossings();
+  for (unsigned int i = 0; i < n; i++) {
+    TrackCrossing key;
+    key.string = NULL;
+    std::vector<TrackCrossing>::const_iterator first, last;
+    if (m_pluckers.direction[i] > 0) {
+      key.s = from[i];
+      first = std::upper_bound(crossings.begin(), crossings.end(), key);
+      key.s = m_pluckers.s[i];
+      last = std::upper_bound(first, crossings.end(), key);
+    } else {
+      key.s = m_pluckers.s[i];
+      first = std::lower_bound(crossings.begin(), crossings.end(), key);
+      key.s = from[i];
+      last = std::lower_bound(first, crossings.end(), key);
+    }
+
+    float amplitude = Plucker::getAmplitude(m_pluckers.weight[i]);
+    for (; first != last; first++) {
+      double crossed = start + fabs(first->s - from[i]) / PLUCKER_VELOCITY;
+      first->string->pluckAt(crossed, amplitude);
+    }
+  }
+
+  for (int i = n - 1; i >= 0; i--)
+    if (m_pluckers.direction[i] > 0 ? m_pluckers.s[i] >= m_length : m_pluckers.s[i] <= 0) {
+      split(i);
+      m_pluckers.remove(i);
+      Plucker::release(1);
+    }
+}
+
+double Track::predictEvent()
+{
+  unsigned int n = m_pluckers.size();
+  if (n == 0)
+    return DBL_MAX;
+
+  // The nearest string or end ahead of any plucker, matching the ranges
+  // syncTo() plucks
+  const std::vector<TrackCrossing>& crossings = getCrossings();
+  float nearest = FLT_MAX;
+  for (unsigned int i = 0; i < n; i++) {
+    TrackCrossing key;
+    key.s = m_pluckers.s[i];
+    key.string = NULL;
+    float distance;
+    if (m_pluckers.direction[i] > 0) {
+      std::vector<TrackCrossing>::const_iterator next = std::upper_bound(crossings.begin(), crossings.end(), key);
+      distance = (next != crossings.end() ? next->s : m_length) - key.s;
+    } else {
+      std::vector<TrackCrossing>::const_iterator next = std::lower_bound(crossings.begin(), crossings.end(), key);
+      distance = key.s - (next != crossings.begin() ? (next - 1)->s : 0);
+    }
+    nearest = std::min(nearest, distance);
   }
+
+  // Rounding can leave a plucker a hair short of its event; make sure the
+  // next try gets there rather than predicting the same time again
+  return m_time + std::max(nearest / PLUCKER_VELOCITY, EVENT_MIN_INTERVAL);
 }
 
 // =======================
@@ -810,6 +1301,7 @@ SpiralTrack::SpiralTrack(Point2D center, float startAngle, float startRadius,
   m_fActive = true;
 
   initialize(center, startAngle, startRadius, endAngle, endRadius, joint1, joint2);
+  WidgetRegistry::add(this, WIDGET_SPIRAL_TRACK);
 }
 
 std::string SpiralTrack::toString()
@@ -858,6 +1350,8 @@ void SpiralTrack::initialize(Point2D center, float startAngle, float startRadius
     m_spiral->setAngles(m_startAngle, m_endAngle);
   } else
     m_spiral = new Spiral(center, m_startAngle, m_startRadius, m_endAngle, m_endRadius);
+  buildTable();
+  SceneIndex::moved(this);
 
   if (!joint1)
     m_joint1->setCenter(getEndPoint1());
@@ -871,6 +1365,7 @@ void SpiralTrack::draw()
 {
   m_spiral->setDotted(!m_fActive);
   m_spiral->setDirected(m_fDirected);
+  m_spiral->setColor(SceneIndex::isHovered(this) ? Color(1, .5, 0, 1) : Color(0, 0, 0, 1));
 
   m_spiral->draw();
   drawChildren();
@@ -897,8 +1392,6 @@ Widget *SpiralTrack::hitTest(float x, float y)
     return this;
 
   Widget* hit = NULL;
-  Color color(0, 0, 0, 1);
-
   Point2D p(x, y);
   float angle = Spiral::getAngle(m_center, p);
   if (angle > m_endAngle && m_endAngle > m_startAngle || angle < m_startAngle) {
@@ -911,88 +1404,108 @@ Widget *SpiralTrack::hitTest(float x, float y)
     }
     float radius = m_endRadius + (m_startRadius - m_endRadius) * (1 - angleDiff / baseAngleDiff);
     float dist = Point2D::distance(m_center, p);
-    if (fabs(radius - dist) < 5) {
-      color = Color(1, .5, 0, 1);
+    if (fabs(radius - dist) < 5)
       hit = this;
-    }
   }
 
-  m_spiral->setColor(color);
   return hit;
 }
 
+bool SpiralTrack::getBounds(Point2D& min, Point2D& max)
+{
+  // The whole circle the spiral winds within, and its joints
+  float radius = std::max(m_startRadius, m_endRadius) + 5;
+  min = Point2D(m_center.x - radius, m_center.y - radius);
+  max = Point2D(m_center.x + radius, m_center.y + radius);
+  for (int i = 0; i < 2; i++) {
+    Point2D jointMin, jointMax;
+    (i == 0 ? m_joint1 : m_joint2)->getBounds(jointMin, jointMax);
+    min = Point2D(std::min(min.x, jointMin.x), std::min(min.y, jointMin.y));
+    max = Point2D(std::max(max.x, jointMax.x), std::max(max.y, jointMax.y));
+  }
+  return true;
+}
+
 void SpiralTrack::toOutboundPacketStream(osc::OutboundPacketStream& ps) const
 {
   ps.Clear();
   ps << osc::BeginMessage("/object/track/spiral")
-     << osc::Symbol(m_uuid.c_str()) << osc::Symbol(m_parent->getUuid())
+     << osc::Symbol(getUuid()) << osc::Symbol(m_parent->getUuid())
      << m_startAngle << m_startRadius << m_endAngle << m_endRadius
      << osc::EndMessage;
 }
 
-Point2D SpiralTrack::getNextPos(bool fReverse, float distance, Point2D pos)
+Point2D SpiralTrack::getPosition(float s)
 {
-  float oradius = m_startRadius,
-        dradius = m_endRadius,
-        oangle = m_startAngle,
-        dangle = m_endAngle,
-        cangle = Spiral::getAngle(m_center, pos);
-  /*
-  if (fabs(cangle - oangle) < 1)
-    cangle = oangle;
+  float x = s * m_tableScale;
+  unsigned int i = x > 0 ? (unsigned int)x : 0;
+  if (i + 1 >= m_table.size())
+    return Point2D(m_center.x + m_table.back().x, m_center.y + m_table.back().y);
 
-  if (fabs(cangle - dangle) < 1)
-    cangle = dangle;
-  */
-  //std::cerr << pos.x << ", " << pos.y << std::endl;
-  // adjust the value of the angle for more convenient computation
-  for (; cangle > oangle; cangle -= 360);
-  for (; dangle > cangle; dangle -= 360);
-
-  float oangleR = oangle * MY_PI / 180,
-        dangleR = dangle * MY_PI / 180,
-        cangleR = cangle * MY_PI / 180;
-
-  float angleDiff = oangle - dangle,
-        angleDiffR = angleDiff * MY_PI / 180;
+  const Point2D &p1 = m_table[i], &p2 = m_table[i + 1];
+  float frac = x - i;
+  return Point2D(m_center.x + p1.x + (p2.x - p1.x) * frac,
+                 m_center.y + p1.y + (p2.y - p1.y) * frac);
+}
 
-  if (angleDiff == 0)
-    return pos;
+void SpiralTrack::getPositions(const float* s, Point2D* positions, unsigned int n)
+{
+  const Point2D* table = &m_table[0];
+  unsigned int last = m_table.size() - 1;
+  for (unsigned int k = 0; k < n; k++) {
+    float x = s[k] * m_tableScale;
+    unsigned int i = x > 0 ? (unsigned int)x : 0;
+    if (i >= last) {
+      positions[k] = Point2D(m_center.x + table[last].x, m_center.y + table[last].y);
+      continue;
+    }
 
-  float radiusDiff = dradius - oradius,
-        rate = radiusDiff / angleDiff,
-        rateR = radiusDiff / angleDiffR;
+    float frac = x - i;
+    positions[k] = Point2D(m_center.x + table[i].x + (table[i + 1].x - table[i].x) * frac,
+                           m_center.y + table[i].y + (table[i + 1].y - table[i].y) * frac);
+  }
+}
 
-  float newAngleR;
-  //std::cerr << rateR << std::endl;
-  if (fabs(radiusDiff) < 0.0001)
-  {
-    newAngleR = cangleR - distance / oradius;
-    // std::cerr << distance / oradius << std::endl;
+void SpiralTrack::buildTable()
+{
+  // Same sweep as the drawn spiral: clockwise from the start angle, with the
+  // radius changing linearly with the angle
+  float endAngle = m_endAngle > m_startAngle ? m_endAngle - 360 : m_endAngle;
+  float angleDiffR = (m_startAngle - endAngle) * MY_PI / 180,
+        radiusDiff = m_endRadius - m_startRadius;
+
+  // Fine samples first, a few per table entry, to measure the arc with
+  float estimate = angleDiffR * std::max(m_startRadius, m_endRadius) + fabs(radiusDiff);
+  unsigned int numSamples = 8 * (unsigned int)(estimate / TRACK_TABLE_SPACING) + 16;
+  std::vector<Point2D> samples;
+  std::vector<float> lengths;
+  samples.reserve(numSamples + 1);
+  lengths.reserve(numSamples + 1);
+  for (unsigned int i = 0; i <= numSamples; i++) {
+    float u = i / (float)numSamples;
+    float angleR = m_startAngle * MY_PI / 180 - u * angleDiffR,
+          radius = m_startRadius + u * radiusDiff;
+    samples.push_back(Point2D(radius * cos(angleR), -radius * sin(angleR)));
+    lengths.push_back(i == 0 ? 0 : lengths[i - 1] + Point2D::distance(samples[i - 1], samples[i]));
   }
-  else 
-  {
-    float a = rateR / 2,
-          b = -oradius - rateR * oangleR,
-          c = oradius * cangleR + rateR * oangleR * cangleR - rateR * cangleR * cangleR / 2 - distance;
-    // new angle
-    float sol1 = (-b + sqrt(b * b - 4 * a * c)) / (2 * a),
-          sol2 = (-b - sqrt(b * b - 4 * a * c)) / (2 * a);
-
-    newAngleR = (sol1 <= cangleR && sol1 >= dangleR) ? sol1 :
-                (sol2 <= cangleR && sol2 >= dangleR) ? sol2 : dangleR;
+  m_length = lengths.back();
+
+  // Then resample at even arc lengths
+  unsigned int numPoints = (unsigned int)ceil(m_length / TRACK_TABLE_SPACING) + 1;
+  m_tableScale = m_length > 0 ? (numPoints - 1) / m_length : 0;
+  m_table.clear();
+  m_table.reserve(numPoints);
+  invalidateCrossings();
+  unsigned int j = 0;
+  for (unsigned int i = 0; i < numPoints; i++) {
+    float s = m_length * i / std::max(1u, numPoints - 1);
+    while (j + 1 < numSamples && lengths[j + 1] < s)
+      j++;
+    float segment = lengths[j + 1] - lengths[j],
+          frac = segment > 0 ? (s - lengths[j]) / segment : 0;
+    m_table.push_back(Point2D(samples[j].x + (samples[j + 1].x - samples[j].x) * frac,
+                              samples[j].y + (samples[j + 1].y - samples[j].y) * frac));
   }
-  float newRadius = oradius + (oangleR - newAngleR) * rateR;
-  Point2D result = Point2D(m_center.x + newRadius * cos(newAngleR), m_center.y - newRadius * sin(newAngleR));
-  /*
-  std::cerr << "SpiralTrack::getNextPos: from " << pos.x << ", " << pos.y
-            << " to " << result.x << ", " << result.y
-            << " distance: " << distance
-            << " start angle: " << oangle << " end angle: " << dangle 
-            << " current angle: " << cangle << " new angle " << (newAngleR * 180 / MY_PI)
-            << " old radius" << oradius << " new radius " << newRadius << std::endl;
-  */
-  return result;
 }
 
 Point2D SpiralTrack::getCenter()
@@ -1004,6 +1517,7 @@ void SpiralTrack::setCenter(const Point2D& center)
 {
   m_center = center;
   m_spiral->setCenter(m_center);
+  SceneIndex::moved(this);
   m_joint1->setCenter(getEndPoint1());
   m_joint2->setCenter(getEndPoint2());
 }
@@ -1012,6 +1526,8 @@ void SpiralTrack::setEndAngle(float angle)
 {
   m_endAngle = Spiral::clampAngle(angle);
   m_spiral->setEndAngle(m_endAngle);
+  buildTable();
+  SceneIndex::moved(this);
   m_joint2->setCenter(getEndPoint2());
 }
 
@@ -1019,6 +1535,8 @@ void SpiralTrack::setEndRadius(float radius)
 {
   m_endRadius = radius;
   m_spiral->setEndRadius(m_endRadius);
+  buildTable();
+  SceneIndex::moved(this);
   m_joint2->setCenter(getEndPoint2());
 }
 
@@ -1053,6 +1571,7 @@ LineTrack::LineTrack(Point2D p1, Point2D p2, Joint *joint1, Joint *joint2) :
   initialize(p1, p2, joint1, joint2);
 
   m_line->setLineWidth(3);
+  WidgetRegistry::add(this, WIDGET_LINE_TRACK);
 }
 
 LineTrack::~LineTrack()
@@ -1083,12 +1602,19 @@ void LineTrack::initialize(Point2D p1, Point2D p2, Joint *joint1, Joint *joint2)
     m_line->setPoints(m_p1, m_p2);
   else
     m_line = new Line(m_p1, m_p2);
+
+  m_length = Point2D::distance(m_p1, m_p2);
+  m_direction = m_length > 0 ? Point2D((m_p2.x - m_p1.x) / m_length, (m_p2.y - m_p1.y) / m_length)
+                             : Point2D(0, 0);
+  invalidateCrossings();
+  SceneIndex::moved(this);
 }
 
 void LineTrack::draw()
 {
   m_line->setDotted(!m_fActive);
   m_line->setDirected(m_fDirected);
+  m_line->setColor(SceneIndex::isHovered(this) ? Color(1, .5, 0, 1) : Color(0, 0, 0, 1));
 
   drawChildren();
 
@@ -1100,50 +1626,44 @@ void LineTrack::draw()
 Widget *LineTrack::hitTest(float x, float y)
 {
   Point2D p(x, y);
-  Widget* hit = NULL;
-  Color color;
   float ppos = m_line->getParallelPosition(p);
   if (m_joint1->hitTest(x, y) || m_joint2->hitTest(x, y) ||
-      ppos > 0 && ppos < 1 && fabs(m_line->getDistance(p)) < 5) {
-    color = Color(1, .5, 0, 1);
-    hit = this;
-  } else
-    color = Color(0, 0, 0, 1);
+      ppos > 0 && ppos < 1 && fabs(m_line->getDistance(p)) < 5)
+    return this;
+  return NULL;
+}
 
-  m_line->setColor(color);
-  return hit;
+bool LineTrack::getBounds(Point2D& min, Point2D& max)
+{
+  min = Point2D(std::min(m_p1.x, m_p2.x) - 5, std::min(m_p1.y, m_p2.y) - 5);
+  max = Point2D(std::max(m_p1.x, m_p2.x) + 5, std::max(m_p1.y, m_p2.y) + 5);
+  for (int i = 0; i < 2; i++) {
+    Point2D jointMin, jointMax;
+    (i == 0 ? m_joint1 : m_joint2)->getBounds(jointMin, jointMax);
+    min = Point2D(std::min(min.x, jointMin.x), std::min(min.y, jointMin.y));
+    max = Point2D(std::max(max.x, jointMax.x), std::max(max.y, jointMax.y));
+  }
+  return true;
 }
 
 void LineTrack::toOutboundPacketStream(osc::OutboundPacketStream& ps) const
 {
   ps.Clear();
   ps << osc::BeginMessage("/object/track/line")
-     << osc::Symbol(m_uuid.c_str()) << osc::Symbol(m_parent->getUuid())
+     << osc::Symbol(getUuid()) << osc::Symbol(m_parent->getUuid())
      << m_p1.x << m_p1.y << m_p2.x << m_p2.y
      << osc::EndMessage;
 }
 
-Point2D LineTrack::getNextPos(bool fReverse, float distance, Point2D pos)
+Point2D LineTrack::getPosition(float s)
 {
-  float dx = m_p2.x - m_p1.x,
-        dy = m_p2.y - m_p1.y;
-  float dist = Point2D::distance(m_p1, m_p2);
-  Point2D res;
-
-  if (!fReverse) {
-    res.x = pos.x + dx / dist * distance;
-    res.y = pos.y + dy / dist * distance;
-  } else {
-    res.x = pos.x - dx / dist * distance;
-    res.y = pos.y - dy / dist * distance;
-  }
-
-  if (Point2D::distance(res, m_p1) > dist)
-    res = m_p2;
-  else if (Point2D::distance(res, m_p2) > dist)
-    res = m_p1;
+  return Point2D(m_p1.x + m_direction.x * s, m_p1.y + m_direction.y * s);
+}
 
-  return res;
+void LineTrack::getPositions(const float* s, Point2D* positions, unsigned int n)
+{
+  for (unsigned int i = 0; i < n; i++)
+    positions[i] = Point2D(m_p1.x + m_direction.x * s[i], m_p1.y + m_direction.y * s[i]);
 }
 
 bool LineTrack::handleHover(float x, float y)
@@ -1153,150 +1673,43 @@ bool LineTrack::handleHover(float x, float y)
   return true;
 }
 
-// ======================
-// Plucker implementation
-// ======================
-
-Plucker::Plucker(Track *track, Joint *startJoint, Joint *endJoint) :
-  m_track(track),
-  m_startJoint(startJoint),
-  m_endJoint(endJoint)
-{
-  if (track) {
-    // If joints don't match track
-    if (!((track->getJoint1() == startJoint && track->getJoint2() == endJoint) ||
-          (track->getJoint2() == startJoint && track->getJoint1() == endJoint)) ||
-          (!startJoint || !endJoint)) {
-      m_startJoint = track->getJoint1();
-      m_endJoint = track->getJoint2();
-    }
-
-    if (!m_startJoint)
-      std::cerr << "Plucker::Plucker: start joint is NULL" << std::endl;
-    m_pos = m_startJoint->getCenter();
-    m_circle = new Spiral(m_pos, 360, 10, 0, 10);
-    m_circle->setFilled(true);
-    m_circle->setColor(Color(0, 0, 0, 0.5));
-  } else
-    std::cerr << "Plucker::Plucker: track is NULL" << std::endl;
-}
-
-std::vector<Plucker *> Plucker::split()
-{
-  // std::cerr << "Plucker splitting" << std::endl;
-  std::vector<Plucker *> results;
-
-  if (isAtEnd()) {
-    std::vector<Track *> tracks = *m_endJoint->getTracks();
-    //std::cerr << tracks.size() << std::endl;
-    for (int i = 0; i < tracks.size();i ++)
-      // Split if there are other not directed paths or directed paths
-      // with their start joints being the end joints of the current path
-      if (tracks[i] != m_track &&
-          (tracks[i]->isEnabled()) && // Make sure that it's not a drawing one
-          (!tracks[i]->isDirected() || tracks[i]->getJoint1() == m_endJoint)) {
-        Plucker *plucker = new Plucker(tracks[i], m_endJoint,
-          (tracks[i]->getJoint1() == m_endJoint) ? tracks[i]->getJoint2() : tracks[i]->getJoint1());
-
-        tracks[i]->addChild(plucker);
-        results.push_back(plucker);
-      }
-  }
-
-  return results;
-}
-
-Side Plucker::getSideOfString(String* string)
-{
-  StringStateMap::iterator sit = m_stringStates.find(string->getUuid());
-  if (sit == m_stringStates.end())
-    updateSideOfString(string);
-  return sit->second;
-}
-
-Side Plucker::updateSideOfString(String* string)
-{
-  StringStateMap::iterator sit = m_stringStates.find(string->getUuid());
-  if (sit == m_stringStates.end()) {
-    StringStateData data(string->getUuid(), 0);
-    sit = m_stringStates.insert(data).first;
-  }
-  float dist = string->getLine()->getDistance(m_pos);
-  if (dist < 0)
-    sit->second = LEFT_SIDE;
-  else
-    sit->second = RIGHT_SIDE;
-  return sit->second;
-}
-
-// Check whether the plucker has reached the end point of a track
-bool Plucker::isAtEnd()
-{
-  //std::cerr << "Plucker::isAtEnd: " << m_pos.x << ", " << m_pos.y << " " << m_endJoint->toString() << std::endl;
-  return m_endJoint->hitTest(m_pos.x, m_pos.y);
-}
-
-void Plucker::draw()
-{
-  m_circle->draw();
-}
-
-void Plucker::tick()
-{
-  RoundPad *pad[2];
-  pad[0] = m_track->getJoint1()->getParentRoundPad();
-  pad[1] = m_track->getJoint2()->getParentRoundPad();
-  for (int i = 0; i < 2; i ++)
-  {
-    if (!pad[i])
-      continue;
-    const std::vector<Widget *> *uncles = pad[i]->getChildren();
-    for (int j = 0; j < uncles->size(); j ++) {
-      String* padString = dynamic_cast<String*>(uncles->at(j));
-      if (padString) {
-        float dist = padString->getLine()->getDistance(m_pos);
-        float ppos = padString->getLine()->getParallelPosition(m_pos);
-        if (ppos > 0 && ppos < 1 && dist < 10 && dist > -10 && dist * getSideOfString(padString) < 0)
-          padString->pluck(this);
-        updateSideOfString(padString);
-      }
-    }
-  }
-
-  if (!isAtEnd()) {
-    m_pos = m_track->getNextPos(!(m_startJoint == m_track->getJoint1()),
-                                PLUCKER_SPEED, m_pos);
-    m_circle->setCenter(m_pos);
-  }
-}
+StringBank* String::s_bank = NULL;
+std::vector<unsigned int> String::s_freeSlots;
+unsigned int String::s_numSlots = 0;
 
-Plucker::~Plucker()
+void String::initializeBank()
 {
-  if (m_circle)
-    delete m_circle;
+  if (!s_bank)
+    s_bank = new StringBank(MAX_STRING_VOICES, STRING_LOWEST_FREQ, MAX_BUFFER_FRAMES);
 }
 
 String::String(Point2D p1, Point2D p2, float radius) :
   m_line(NULL),
-  m_lastPlucker(NULL),
-  m_mouseSide(0)
+  m_mouseSide(0),
+  m_voice(s_bank ? s_bank->allocate() : StringBank::INVALID_VOICE)
 {
+  if (s_freeSlots.empty())
+    m_slot = s_numSlots++;
+  else {
+    m_slot = s_freeSlots.back();
+    s_freeSlots.pop_back();
+  }
+
   initialize(p1, p2, radius);
   m_line->setLineWidth(2);
+  WidgetRegistry::add(this, WIDGET_STRING);
 }
 
 String::~String()
 {
+  // Make sure the audio thread is done with us before anything goes away
+  SoundSource::removeGlobal(this);
+  if (s_bank)
+    s_bank->release(m_voice);
+  s_freeSlots.push_back(m_slot);
   delete m_line;
   delete m_p1Dot;
   delete m_p2Dot;
-  SoundSource::lockGlobals();
-  {
-    // Erases are super fast...right?
-    SoundSource::getAllForAudio()->erase(m_uuid);
-  }
-  SoundSource::unlockGlobals();
-  SoundSource::getAllForEngine()->erase(m_uuid);
 }
 
 void String::initialize(Point2D p1, Point2D p2, float radius)
@@ -1313,6 +1726,7 @@ void String::initialize(Point2D p1, Point2D p2, float radius)
     m_line->setPoints(m_p1, m_p2);
   else
     m_line = new Line(m_p1, m_p2);
+  SceneIndex::moved(this);
   
   setPadRadius(radius);
 }
@@ -1336,8 +1750,6 @@ Side String::updateMouseSide(float x, float y)
 
 void String::setPadRadius(float radius)
 {
-  m_plucked.noteOff(1);
-
   if (radius < 0.001)
     m_freq = 880.;
   else {
@@ -1345,7 +1757,7 @@ void String::setPadRadius(float radius)
     m_freq = 880. - m_freq * 770.;
   }
 
-  m_plucked.noteOn(m_freq, 1);
+  pluck();
 }
 
 Widget *String::hitTest(float x, float y)
@@ -1354,48 +1766,59 @@ Widget *String::hitTest(float x, float y)
   float ppos = m_line->getParallelPosition(p);
   if (Point2D::distance(m_p1, p) <= m_p1Dot->getStartRadius() ||
       Point2D::distance(m_p2, p) <= m_p2Dot->getStartRadius() ||
-      ppos > 0 && ppos < 1 && fabs(m_line->getDistance(p)) < 5) {
-    Color color(1, .5, 0, 1);
-    m_line->setColor(color);
-    m_p1Dot->setColor(color);
-    m_p2Dot->setColor(color);
+      ppos > 0 && ppos < 1 && fabs(m_line->getDistance(p)) < 5)
     return this;
-  }
-
-  Color color(0, 0, 0, 1);
-  m_line->setColor(color);
-  m_p1Dot->setColor(color);
-  m_p2Dot->setColor(color);
   return NULL;
 }
 
+bool String::getBounds(Point2D& min, Point2D& max)
+{
+  // Wide enough for the dots at the ends as well as the line
+  float margin = std::max(5.f, std::max(m_p1Dot->getStartRadius(), m_p2Dot->getStartRadius()));
+  min = Point2D(std::min(m_p1.x, m_p2.x) - margin, std::min(m_p1.y, m_p2.y) - margin);
+  max = Point2D(std::max(m_p1.x, m_p2.x) + margin, std::max(m_p1.y, m_p2.y) + margin);
+  return true;
+}
+
 void String::toOutboundPacketStream(osc::OutboundPacketStream& ps) const
 {
   ps.Clear();
   ps << osc::BeginMessage("/object/track/string")
-     << osc::Symbol(m_uuid.c_str()) << osc::Symbol(m_parent->getUuid())
+     << osc::Symbol(getUuid()) << osc::Symbol(m_parent->getUuid())
      << m_p1.x << m_p1.y << m_p2.x << m_p2.y
      << osc::EndMessage;
 }
 
-bool String::pluck(Plucker *plucker)
+bool String::pluck()
 {
-  m_plucked.noteOn(m_freq, 1);
+  return pluckAt(Clock::now());
+}
+
+bool String::pluckAt(double time, float amplitude)
+{
+  // The bank belongs to the audio thread, so ask it to do the plucking
+  PluckEvent event;
+  event.sourceId = m_sourceId;
+  event.voice = m_voice;
+  event.frame = SoundSource::getPluckFrame(time);
+  event.frequency = m_freq;
+  event.amplitude = amplitude;
+  SoundSource::queuePluck(event);
   return true;
 }
 
 void String::draw()
 {
+  Color color = SceneIndex::isHovered(this) ? Color(1, .5, 0, 1) : Color(0, 0, 0, 1);
+  m_line->setColor(color);
+  m_p1Dot->setColor(color);
+  m_p2Dot->setColor(color);
+
   m_line->draw();
   m_p1Dot->draw();
   m_p2Dot->draw();
 }
 
-SAMPLE String::tick()
-{
-  return m_plucked.tick();
-}
-
 bool String::handleHover(float x, float y)
 {
   ((Engine*)getEngine())->setSelectedWidget(this);
@@ -1404,7 +1827,7 @@ bool String::handleHover(float x, float y)
   float dist = m_line->getDistance(pos);
   float ppos = m_line->getParallelPosition(pos);
   if (ppos > 0 && ppos < 1 && dist * getMouseSide(x, y) < 0)
-    pluck(NULL);
+    pluck();
   updateMouseSide(x, y);
 
   return true;
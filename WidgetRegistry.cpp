@@ -0,0 +1,77 @@
+#include "WidgetRegistry.h"
+#include "Widget.h"
+
+Arena* WidgetRegistry::s_arenas[WIDGET_NUM_TYPES];
+Widget* WidgetRegistry::s_first[WIDGET_NUM_TYPES];
+unsigned int WidgetRegistry::s_count[WIDGET_NUM_TYPES];
+
+void WidgetRegistry::add(Widget* widget, WidgetType type)
+{
+  remove(widget);
+  if (type == WIDGET_OTHER)
+    return;
+
+  Widget* next = s_first[type];
+  widget->setTypeLinks(type, NULL, next);
+  if (next)
+    next->setTypeLinks(type, widget, next->getNextOfType());
+  s_first[type] = widget;
+  s_count[type]++;
+}
+
+void WidgetRegistry::remove(Widget* widget)
+{
+  WidgetType type = widget->getType();
+  if (type == WIDGET_OTHER)
+    return;
+
+  Widget *prev = widget->getPrevOfType(), *next = widget->getNextOfType();
+  if (prev)
+    prev->setTypeLinks(type, prev->getPrevOfType(), next);
+  else
+    s_first[type] = next;
+  if (next)
+    next->setTypeLinks(type, prev, next->getNextOfType());
+  widget->setTypeLinks(WIDGET_OTHER, NULL, NULL);
+  s_count[type]--;
+}
+
+void* WidgetRegistry::allocate(WidgetType type, size_t size)
+{
+  // Made on first use and kept for good, so no widget outlives its arena
+  if (!s_arenas[type])
+    s_arenas[type] = new Arena(size);
+  return s_arenas[type]->allocate();
+}
+
+void WidgetRegistry::free(WidgetType type, void* widget)
+{
+  if (widget)
+    s_arenas[type]->free(widget);
+}
+
+WidgetHandle WidgetRegistry::getHandle(const Widget* widget)
+{
+  WidgetHandle handle;
+  if (widget && widget->getType() != WIDGET_OTHER) {
+    handle.type = widget->getType();
+    handle.handle = s_arenas[handle.type]->getHandle(dynamic_cast<const void*>(widget));
+  }
+  return handle;
+}
+
+Widget* WidgetRegistry::get(WidgetHandle handle)
+{
+  if (handle.type == WIDGET_OTHER || !s_arenas[handle.type])
+    return NULL;
+
+  void* widget = s_arenas[handle.type]->get(handle.handle);
+  switch (handle.type) {
+  case WIDGET_PAD:          return (RoundPad*)widget;
+  case WIDGET_SPIRAL_TRACK: return (SpiralTrack*)widget;
+  case WIDGET_LINE_TRACK:   return (LineTrack*)widget;
+  case WIDGET_JOINT:        return (Joint*)widget;
+  case WIDGET_STRING:       return (String*)widget;
+  default:                  return NULL;
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef __ARENA_H_
+#define __ARENA_H_
+
+#include <stddef.h>
+#include <vector>
+
+/**
+* Names an object in an arena. Stays valid after the object is freed, and
+* then no longer finds it, even if its slot has been reused.
+*/
+struct Handle
+{
+  unsigned int index;
+  unsigned int generation; // Odd while live; 0 is never live
+
+  Handle() : index(0), generation(0) {}
+  bool isNull() const { return generation == 0; }
+  bool operator==(const Handle& other) const { return index == other.index && generation == other.generation; }
+};
+
+/**
+* Storage for objects of one size, in slabs of ARENA_SLAB_SIZE slots, so
+* that objects of a kind sit together instead of across the heap. Freed
+* slots are reused first; slabs are never given back.
+*
+* Not thread safe; the scene's arenas are used with the scene lock held.
+*/
+class Arena
+{
+public:
+  Arena(size_t objectSize);
+  ~Arena();
+
+  void* allocate();
+  void free(void* object);
+
+  Handle getHandle(const void* object) const;
+  /**
+  * The object the handle names, or NULL if it has been freed
+  */
+  void* get(Handle handle) const;
+
+  size_t getObjectSize() const { return m_objectSize; }
+  unsigned int size() const { return m_numLive; }
+
+private:
+  struct Slot
+  {
+    unsigned int index;
+    unsigned int generation;
+    Slot* nextFree;
+  };
+
+  // The object follows its slot header, 16-byte aligned
+  static const size_t HEADER_SIZE = (sizeof(Slot) + 15) & ~(size_t)15;
+
+  Slot* getSlot(unsigned int index) const;
+
+  size_t m_objectSize, m_stride;
+  std::vector<char*> m_slabs;
+  Slot* m_free;
+  unsigned int m_numLive;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __AUDIO_STATS_H_
+#define __AUDIO_STATS_H_
+
+#include <string>
+#include <atomic>
+
+#include "Common.h"
+
+/**
+* Counters and a load histogram, copied out of AudioStats in one go.
+* Load is callback wall time as a fraction of the buffer's duration.
+*/
+struct AudioStatsSnapshot
+{
+  unsigned long long callbacks, late, underflows, overflows;
+  unsigned long long droppedPlucks; // More in one buffer than the bank queues
+  unsigned int bins[AUDIO_STATS_BINS];
+  float peakLoad;
+};
+
+/**
+* Timing and xrun accounting for the audio callback. The audio thread only
+* bumps atomic counters; all the arithmetic happens on the reading side.
+*/
+class AudioStats
+{
+public:
+  /**
+  * Accounts for one callback that took elapsed seconds to render a buffer
+  * lasting duration seconds. Audio thread only.
+  */
+  static void record(double elapsed, double duration, bool fUnderflow, bool fOverflow);
+  /**
+  * Accounts for a pluck that didn't fit in the buffer's queue
+  */
+  static void recordDroppedPluck() { s_droppedPlucks.fetch_add(1, std::memory_order_relaxed); }
+
+  /**
+  * Copies the totals since start-up
+  */
+  static void take(AudioStatsSnapshot&);
+  /**
+  * Returns what happened between two snapshots, e.g. for a log period
+  */
+  static AudioStatsSnapshot difference(const AudioStatsSnapshot& now, const AudioStatsSnapshot& before);
+  /**
+  * Returns the load below which the given fraction of callbacks stayed
+  */
+  static float getPercentile(const AudioStatsSnapshot&, float fraction);
+  /**
+  * One line summary for the log
+  */
+  static std::string describe(const AudioStatsSnapshot&);
+
+private:
+  static std::atomic<unsigned long long> s_callbacks, s_late, s_underflows, s_overflows;
+  static std::atomic<unsigned long long> s_droppedPlucks;
+  static std::atomic<unsigned int> s_bins[AUDIO_STATS_BINS];
+  static std::atomic<float> s_peakLoad;
+};
+
+#endif
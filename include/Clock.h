@@ -0,0 +1,32 @@
+#ifndef __CLOCK_H_
+#define __CLOCK_H_
+
+#include <time.h>
+
+/**
+* Monotonic time source shared by the audio, simulation and GUI threads
+*/
+class Clock
+{
+public:
+  /**
+  * Returns the time in seconds since an arbitrary fixed point
+  */
+  static inline double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+
+  /**
+  * Returns the wall clock time in seconds since the epoch, which peers
+  * agree on as far as their clocks are synchronized
+  */
+  static inline double wallTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+};
+
+#endif
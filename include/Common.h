@@ -6,9 +6,47 @@
 
 // RtAudio Settings
 #define SAMPLE float
+
+// Audio defaults, all of which can be changed from the command line
 #define MY_SRATE 44100
 #define NUM_CHANNS 1
 #define BUFFER_SIZE 512
+#define MIN_BUFFER_FRAMES 32
+#define MAX_CHANNELS 32
+
+// Adaptive buffer sizing: shrink after ADAPT_STABLE_PERIODS clean periods
+// with the p99 load under ADAPT_SHRINK_LOAD, grow after any xrun
+#define ADAPT_PERIOD_SECS 5
+#define ADAPT_SHRINK_LOAD 0.3
+#define ADAPT_STABLE_PERIODS 3
+
+// Sources quieter than this for SILENCE_HOLD_MSECS are put to sleep
+#define SILENCE_THRESHOLD 0.0001
+#define SILENCE_HOLD_MSECS 100
+
+// Pluck events handed from the GUI and network threads to the audio thread
+#define PLUCK_QUEUE_SIZE 4096
+#define MAX_PENDING_PLUCKS 1024
+#define PLUCK_EXPIRY_MSECS 1000
+
+// Sizing of the string bank; strings past MAX_STRING_VOICES stay silent
+#define MAX_STRING_VOICES 1024
+#define STRING_LOWEST_FREQ 55
+#define MAX_BUFFER_FRAMES 8192
+
+// Parallel rendering: task sizes, and the share of a buffer's duration the
+// render may take before the pool falls back to serial for a while
+#define MAX_RENDER_THREADS 16
+#define RENDER_GROUPS_PER_TASK 4
+#define RENDER_SOURCES_PER_TASK 4
+#define RENDER_DEADLINE 0.75
+#define RENDER_FALLBACK_BUFFERS 256
+#define RENDER_WORKER_SPIN 2000
+
+// Audio callback load histogram, in 2% steps of the buffer duration
+#define AUDIO_STATS_BINS 128
+#define AUDIO_STATS_BIN_WIDTH 0.02
+#define AUDIO_STATS_LOG_SECS 10
 
 // Target 30 FPS
 #define TIMER_MSECS 33
@@ -16,6 +54,45 @@
 // Control rate of pluckers
 #define ANGLE_DELTA 0.05
 #define PLUCKER_SPEED 10
+// Pixels per second, the old speed of PLUCKER_SPEED per timer tick
+#define PLUCKER_VELOCITY (PLUCKER_SPEED * 1000.0 / TIMER_MSECS)
+
+// Default limits on the number of pluckers, in all and on any one track, and
+// how close (in pixels of arc) two pluckers going the same way get merged
+#define MAX_PLUCKERS 4096
+#define MAX_TRACK_PLUCKERS 64
+#define PLUCKER_MERGE_DISTANCE 1
+// A single plucker plucks as hard as a click does, at 1; merged ones pluck
+// harder, up to this. The string bank's pluck filter stays stable well past it.
+#define PLUCKER_MAX_AMPLITUDE 2
+
+// Spacing, in pixels of arc, of the points tracks are looked up from
+#define TRACK_TABLE_SPACING 2
+
+// Simulation steps per second, and how many steps late it may fall before
+// giving up on catching up
+#define SIMULATION_RATE 1000
+#define SIMULATION_MAX_LAG 100
+// Shortest wait between events in event driven mode, in seconds
+#define EVENT_MIN_INTERVAL 1e-6
+// How long, in seconds, local input waits in lockstep so that it reaches
+// the peers before it takes effect
+#define LOCKSTEP_INPUT_DELAY 0.1
+
+// Angular bins of each pad's string index, and how close to the pad's
+// center a segment may pass before it counts as being in every bin
+#define STRING_INDEX_BINS 64
+#define STRING_INDEX_CENTER 1
+// Grid cell size, in pixels, and number of hash buckets for finding the
+// widgets under the pointer
+#define SCENE_CELL_SIZE 64
+#define SCENE_HASH_BUCKETS 1024
+// Radius of the joints at the ends of tracks, and the grid cell size of the
+// index used to snap new tracks to them
+#define JOINT_RADIUS 7
+#define JOINT_INDEX_CELL 16
+// Objects per slab in the arenas that widgets are allocated from
+#define ARENA_SLAB_SIZE 64
 
 #include <uuid/uuid.h>
 
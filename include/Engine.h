@@ -7,6 +7,8 @@
 
 #include "Widget.h"
 
+class Simulation;
+
 /**
 * The root class that handles all the user interaction and graphical interface rendering.
 */
@@ -33,7 +35,9 @@ public:
   virtual bool handleDraw(float x, float y);
   virtual bool handleDrawEnd(float x, float y);
 
-  void setSelectedWidget(Widget* widget) { m_selectedWidget = widget; }
+  void setSelectedWidget(Widget* widget) { m_selectedWidget = WidgetRegistry::getHandle(widget); }
+  void setSimulation(Simulation* simulation) { m_simulation = simulation; }
+  Simulation* getSimulation() { return m_simulation; }
 
   void setMouseCursorPosition(float, float);
   void setSize(int, int);
@@ -43,9 +47,14 @@ public:
 
 private:
   RoundPad *m_newRoundPad;
-  Widget* m_selectedWidget;
+  WidgetHandle m_selectedWidget; // Can be deleted by a peer while selected
   Spiral* m_mouseCursor;
   Text* m_cursorText;
+  Text* m_voiceText;
+  Simulation* m_simulation;
+  Spiral* m_pluckerCircle;
+  std::vector<Point2D> m_pluckerPositions;
+  Point2D m_mousePos;
   TextMode m_textMode;
   Line m_xLine, m_yLine;
   int m_width, m_height;
@@ -0,0 +1,74 @@
+#ifndef __EVENT_QUEUE_H_
+#define __EVENT_QUEUE_H_
+
+#include <vector>
+#include <queue>
+
+class Widget;
+class Track;
+
+/**
+* Pluckers move at a constant speed along fixed paths, so when the next one
+* crosses a string or reaches a joint can be worked out in advance. In event
+* driven mode each track with pluckers has its next such event queued here,
+* and the simulation sleeps from one event to the next instead of stepping.
+*
+* A track is only brought up to date when one of its events fires, or when
+* something else touches it. Scene lock held throughout.
+*/
+class EventQueue
+{
+public:
+  /**
+  * Switches to event driven mode, taking the pluckers already on the
+  * tracks to be where they are at time. Call after TrackGraph::update().
+  */
+  static void start(double time);
+  static bool isEnabled() { return s_fEnabled; }
+
+  /**
+  * The time of the event being fired, or else the time now
+  */
+  static double getTime();
+
+  /**
+  * Predicts the next event on track and queues it, replacing any queued before
+  */
+  static void schedule(Track* track);
+  /**
+  * Marks every prediction stale, e.g. when a track changes shape
+  */
+  static void invalidate() { s_fChanged = true; }
+  /**
+  * If the tracks or strings changed, brings every track to time and
+  * predicts again. Call after TrackGraph::update().
+  */
+  static void update(double time);
+
+  /**
+  * Fires, in order, the events due by time
+  */
+  static void fire(double time);
+  /**
+  * When the next event is due, or DBL_MAX if nothing is moving
+  */
+  static double getNextTime();
+
+private:
+  struct Event
+  {
+    double time;
+    Track* track;
+    unsigned int serial; // Stale unless it matches the track's
+
+    // Earliest first out of the priority queue
+    bool operator<(const Event& other) const { return time > other.time; }
+  };
+
+  static bool s_fEnabled, s_fChanged, s_fFiring;
+  static double s_time;
+  static unsigned int s_graphVersion, s_stringVersion;
+  static std::priority_queue<Event> s_events;
+};
+
+#endif
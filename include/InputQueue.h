@@ -0,0 +1,44 @@
+#ifndef __INPUT_QUEUE_H_
+#define __INPUT_QUEUE_H_
+
+#include <vector>
+
+/**
+* A mouse or keyboard event from GLUT, held until the next frame
+*/
+struct InputEvent
+{
+  enum Type { MOTION, BUTTON, KEY };
+
+  Type type;
+  int button, state; // BUTTON only
+  unsigned char key; // KEY only
+  int x, y;
+};
+
+/**
+* The GLUT callbacks only queue their events here, and the display callback
+* handles them all once per frame. Motion between two other events is
+* coalesced down to its last position, since a fast mouse can report
+* several moves a frame and each one costs a hover pass and a message to
+* every peer. Buttons and keys are kept, in order.
+*
+* GUI thread only.
+*/
+class InputQueue
+{
+public:
+  static void pushMotion(int x, int y);
+  static void pushButton(int button, int state, int x, int y);
+  static void pushKey(unsigned char key, int x, int y);
+
+  /**
+  * Moves the queued events, oldest first, into events
+  */
+  static void take(std::vector<InputEvent>& events);
+
+private:
+  static std::vector<InputEvent> s_events;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef __JOINT_INDEX_H_
+#define __JOINT_INDEX_H_
+
+#include <vector>
+#include <map>
+
+#include "Common.h"
+#include "Point.h"
+
+class Joint;
+
+/**
+* The centers of the joints in the scene, in a grid of JOINT_INDEX_CELL
+* sized cells, for snapping new tracks to the joints near the pointer.
+*
+* Kept up to date as joints go: a track puts its joints in when it joins
+* the scene, a joint moves itself when its center changes and takes itself
+* out when deleted. Scene lock held.
+*/
+class JointIndex
+{
+public:
+  static void insert(Joint* joint);
+  static void remove(Joint* joint);
+  static void move(Joint* joint);
+
+  /**
+  * Fills joints with those whose centers are within radius of p, nearest first
+  */
+  static void findAll(Point2D p, float radius, std::vector<Joint*>& joints);
+  /**
+  * The nearest joint within radius of p other than except, or NULL
+  */
+  static Joint* find(Point2D p, float radius, const Joint* except = NULL);
+
+  static unsigned int size() { return s_numJoints; }
+
+private:
+  static long long getKey(Point2D p);
+
+  static std::map<long long, std::vector<Joint*> > s_cells;
+  static unsigned int s_numJoints;
+};
+
+#endif
@@ -24,17 +24,38 @@ class MyAudio {
     ~MyAudio();
 
   public:
+    // Call these before setup(); a negative device picks the default one
+    void setDevice( int deviceId ) { m_deviceId = deviceId; };
+    void setOutputOnly( bool fOutputOnly ) { m_fOutputOnly = fOutputOnly; };
+
     void setup( RtAudioCallback callback, void * userData = NULL );
     void start();
     void stop();
+    /**
+    * Restarts the stream asking for a new buffer size. Falls back to the
+    * current size, and returns false, if the device won't take it.
+    */
+    bool reopen( unsigned int buffSize );
     unsigned int bufferSize() { return m_bufferSize; };
+    float sampleRate() { return m_sampleRate; };
+
+    /**
+    * Prints the devices RtAudio can see, with their ids
+    */
+    static void listDevices();
 
   private:
+    void openStream();
+
     RtAudio * m_audio;
     unsigned int m_numChannels;
     float m_sampleRate;
     unsigned int m_bufferSize;
     RtAudioFormat m_format;
+    int m_deviceId;
+    bool m_fOutputOnly;
+    RtAudioCallback m_callback;
+    void * m_userData;
 };
 
 #endif
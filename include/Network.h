@@ -76,7 +76,10 @@ class Network : public osc::OscPacketListener
     void sendPeerMessage(const std::string);
     void sendPeerTextMessage(const std::string);
     void sendMousePosition(const float x, const float y, const bool down);
-    void sendPlucker(const Track*);
+    /**
+    * Starts a plucker on the peers' copy of the track; in lockstep, at the given step
+    */
+    void sendPlucker(const Track*, unsigned long long tick = 0);
 
     void sendObjectMessage(const Widget*, bool = false);
 
@@ -101,6 +104,10 @@ class Network : public osc::OscPacketListener
     void handleObjectDeleteMessage(const osc::ReceivedMessage&, const IpEndpointName&);
     void handleObjectQueryMessage(const osc::ReceivedMessage&, const IpEndpointName&);
     void handleMousePositionMessage(const osc::ReceivedMessage&, const IpEndpointName&);
+    // For monitoring tools: /stats/query [listen port] is answered with
+    // /stats/audio, on the listen port if given or else the sending port
+    void handleStatsQueryMessage(const osc::ReceivedMessage&, const IpEndpointName&);
+    void handleStatsAudioMessage(const osc::ReceivedMessage&, const IpEndpointName&);
 
     void rescueOrphans();
 
@@ -0,0 +1,47 @@
+#ifndef __PLUCK_QUEUE_H_
+#define __PLUCK_QUEUE_H_
+
+#include <atomic>
+
+/**
+* A request to pluck a sound source at an absolute stream frame
+*/
+struct PluckEvent
+{
+  unsigned int sourceId;
+  unsigned int voice; // The string bank voice, or StringBank::INVALID_VOICE
+  double frame;
+  float frequency;
+  float amplitude;
+};
+
+/**
+* Bounded lock-free queue of pluck events. Any thread can push; only the
+* audio thread pops.
+*/
+class PluckQueue
+{
+public:
+  PluckQueue(unsigned int capacity);
+  ~PluckQueue();
+
+  /**
+  * Returns false, dropping the event, if the queue is full
+  */
+  bool push(const PluckEvent& event);
+  bool pop(PluckEvent& event);
+
+private:
+  struct Cell
+  {
+    std::atomic<unsigned long> sequence;
+    PluckEvent event;
+  };
+
+  Cell* m_cells;
+  unsigned long m_mask;
+  std::atomic<unsigned long> m_head; // Next slot for producers
+  unsigned long m_tail;              // Next slot for the consumer
+};
+
+#endif
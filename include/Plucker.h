@@ -0,0 +1,97 @@
+#ifndef __PLUCKER_H_
+#define __PLUCKER_H_
+
+#include <vector>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+
+#include "Common.h"
+#include "Point.h"
+
+/**
+* The pluckers on one track, one array per field, so that a whole track's
+* worth can be moved in a single pass. Removing one moves the last one into
+* its place, so the order is not kept.
+*/
+struct PluckerArrays
+{
+  std::vector<float> s;                     // Arc length from the track's joint 1
+  std::vector<float> direction;             // 1 towards joint 2, -1 towards joint 1
+  std::vector<unsigned int> weight;         // How many pluckers each one stands for
+  std::vector<Point2D> pos, previousPos;    // Now and one simulation step ago
+
+  unsigned int size() const { return s.size(); }
+
+  void add(float s0, float direction0, unsigned int weight0, Point2D pos0) {
+    s.push_back(s0);
+    direction.push_back(direction0);
+    weight.push_back(weight0);
+    pos.push_back(pos0);
+    previousPos.push_back(pos0);
+  }
+
+  void remove(unsigned int i) {
+    unsigned int last = size() - 1;
+    s[i] = s[last]; s.pop_back();
+    direction[i] = direction[last]; direction.pop_back();
+    weight[i] = weight[last]; weight.pop_back();
+    pos[i] = pos[last]; pos.pop_back();
+    previousPos[i] = previousPos[last]; previousPos.pop_back();
+  }
+
+  void clear() {
+    s.clear();
+    direction.clear();
+    weight.clear();
+    pos.clear();
+    previousPos.clear();
+  }
+};
+
+/**
+* The pluckers themselves live on their tracks, in PluckerArrays. This keeps
+* the limits and counters they share, and the kernel that moves them. All of
+* it is used under the scene lock.
+*/
+class Plucker
+{
+public:
+  /**
+  * Beyond maxTotal pluckers reserve() fails, and beyond maxPerTrack a track
+  * drops the ones it is given
+  */
+  static void setLimits(unsigned int maxTotal, unsigned int maxPerTrack);
+  static unsigned int getMaxPerTrack() { return s_maxPerTrack; }
+  /**
+  * Claims room for one more plucker; if there is none, counts it dropped
+  */
+  static bool reserve();
+  static void release(unsigned int count) { s_numLive.fetch_sub(count, std::memory_order_relaxed); }
+
+  static void countDropped() { s_numDropped.fetch_add(1, std::memory_order_relaxed); }
+  static void countMerged() { s_numMerged.fetch_add(1, std::memory_order_relaxed); }
+  static unsigned int getLiveCount() { return s_numLive.load(std::memory_order_relaxed); }
+  static unsigned long long getDroppedCount() { return s_numDropped.load(std::memory_order_relaxed); }
+  static unsigned long long getMergedCount() { return s_numMerged.load(std::memory_order_relaxed); }
+
+  /**
+  * How hard a plucker standing for weight merged ones plucks: as loud as
+  * that many plucks at once would add up to, up to PLUCKER_MAX_AMPLITUDE
+  */
+  static float getAmplitude(unsigned int weight) { return std::min((float)PLUCKER_MAX_AMPLITUDE, sqrtf(weight)); }
+
+  /**
+  * Moves n pluckers ds along a track of the given length, each one in its
+  * own direction, stopping at the ends
+  */
+  static void advance(float* s, const float* direction, unsigned int n, float ds, float length);
+
+private:
+  // Atomic for the status line, which is drawn while the simulation steps
+  static std::atomic<unsigned int> s_numLive;
+  static unsigned int s_maxTotal, s_maxPerTrack;
+  static std::atomic<unsigned long long> s_numDropped, s_numMerged;
+};
+
+#endif
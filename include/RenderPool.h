@@ -0,0 +1,87 @@
+#ifndef __RENDER_POOL_H_
+#define __RENDER_POOL_H_
+
+#include <vector>
+#include <atomic>
+#include <semaphore.h>
+
+#include "Common.h"
+#include "stk/Thread.h"
+
+class SoundSource;
+class StringBank;
+
+/**
+* Renders one audio buffer on several cores. The work (ranges of string bank
+* groups and chunks of other sources) is split evenly between the audio
+* thread and the workers, and whoever runs out steals from the others. Every
+* thread renders into its own buffers, which are summed at the end.
+*
+* Nothing is allocated while rendering, and the audio thread never takes a
+* lock or sleeps: it wakes workers with a semaphore post, and only if they
+* went to sleep. If a parallel buffer misses its deadline the pool renders
+* serially for a while before trying again.
+*/
+class RenderPool
+{
+public:
+  /**
+  * numThreads counts the audio thread, so 1 means serial rendering
+  */
+  RenderPool(unsigned int numThreads, StringBank* bank, unsigned int maxFrames);
+  ~RenderPool();
+
+  /**
+  * Adds the bank and all awake sources to out. Returns the number of
+  * sources rendered. Audio thread only.
+  */
+  unsigned int render(const std::vector<SoundSource*>& sources,
+                      SAMPLE* out, unsigned int nFrames, unsigned int stride);
+
+  unsigned int getThreadCount() { return m_numThreads; }
+  bool isSerial() { return m_serialBuffers.load() > 0 || m_numThreads == 1; }
+  unsigned int getMissedDeadlines() { return m_numMissed.load(); }
+
+private:
+  struct Participant
+  {
+    RenderPool* pool;
+    unsigned int index;
+    std::atomic<unsigned long long> tasks; // Job, first and last task, packed
+    float* mix;              // Bank lanes
+    SAMPLE* buffer;          // Everything else
+    std::atomic<unsigned int> usedJob; // Job the buffers were last written for
+    unsigned int active;
+    // Workers only
+    stk::Thread thread;
+    sem_t wake;
+    std::atomic<bool> fSleeping; // Cleared by whoever posts wake
+    unsigned int seenJob;
+  };
+
+  static void* work(void* participant);
+  void wakeWorkers();
+  unsigned int renderSerial(const std::vector<SoundSource*>& sources,
+                            SAMPLE* out, unsigned int nFrames, unsigned int stride);
+  void runJob(Participant* self, unsigned int job);
+  bool takeTask(Participant* self, unsigned int job, unsigned int& task);
+  void renderTask(Participant* self, unsigned int job, unsigned int task);
+
+  unsigned int m_numThreads;
+  Participant* m_participants;
+  StringBank* m_bank;
+  unsigned int m_maxFrames;
+
+  // The job being rendered, written by the audio thread before it starts
+  std::atomic<unsigned int> m_job;
+  const std::vector<SoundSource*>* m_sources;
+  unsigned int m_nFrames;
+  unsigned int m_numGroups, m_numGroupTasks, m_numTasks;
+  std::atomic<unsigned int> m_inFlight;
+  std::atomic<bool> m_fQuit;
+
+  std::atomic<unsigned int> m_serialBuffers; // Left to render serially after a missed deadline
+  std::atomic<unsigned int> m_numMissed;
+};
+
+#endif
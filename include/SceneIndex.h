@@ -0,0 +1,74 @@
+#ifndef __SCENE_INDEX_H_
+#define __SCENE_INDEX_H_
+
+#include <vector>
+
+#include "Common.h"
+#include "Point.h"
+
+class Widget;
+
+/**
+* Every widget in the scene, hashed by the grid cells its bounding box
+* covers, so that finding what is under the pointer only looks at what is
+* near it. Widgets without bounds are checked everywhere.
+*
+* Widgets are numbered in drawing order, so queries can list the topmost
+* first. Anything that adds, removes or moves a widget calls invalidate()
+* or moved(), and the next query rebuilds the index. Scene lock held.
+*/
+class SceneIndex
+{
+public:
+  static void setRoot(Widget* root) { s_root = root; s_fChanged = true; }
+  static void invalidate() { s_fChanged = true; }
+  /**
+  * Call when a widget's bounds change; cheap for widgets not in the scene
+  */
+  static void moved(const Widget* widget);
+
+  /**
+  * Fills hits with the widgets under (x, y), topmost first
+  */
+  static void query(float x, float y, std::vector<Widget*>& hits);
+  /**
+  * The topmost child of parent under (x, y), or NULL
+  */
+  static Widget* pickChild(Widget* parent, float x, float y);
+
+  /**
+  * Works out which widgets the pointer at (x, y) is over, from the root
+  * down, for drawing them highlighted. Call once per frame.
+  */
+  static void updateHover(float x, float y);
+  static bool isHovered(const Widget* widget);
+
+private:
+  struct Entry
+  {
+    Widget* widget;
+    Widget* parent;    // Shared joints are entered once under each track
+    unsigned int z;    // Drawing order, higher on top
+    bool fBounded;
+    Point2D min, max;
+  };
+
+  static void update();
+  static void collect(Widget* parent, unsigned int& z);
+  static unsigned int getBucket(int cx, int cy);
+  /**
+  * Fills s_candidates with the entries whose box holds (x, y), topmost first
+  */
+  static void findCandidates(float x, float y);
+
+  static Widget* s_root;
+  static bool s_fChanged;
+  static unsigned int s_version;
+  static std::vector<Entry> s_entries;
+  static std::vector<unsigned int> s_buckets[SCENE_HASH_BUCKETS];
+  static std::vector<unsigned int> s_unbounded;
+  static std::vector<unsigned int> s_candidates;
+  static std::vector<Widget*> s_hovered;
+};
+
+#endif
@@ -91,11 +91,22 @@ public:
   */
   virtual float getDistance(Point2D pos);
   virtual float getParallelPosition(Point2D pos);
+  /**
+  * Returns whether the segment from -> to crosses the line between its
+  * end points, and if so how far along the segment, from 0 to 1. A segment
+  * merely ending on the line counts; one starting on it doesn't, so that
+  * consecutive segments of a path cross only once.
+  */
+  virtual bool getIntersection(Point2D from, Point2D to, float& t);
+  static bool getIntersection(Point2D from, Point2D to, Point2D p1, Point2D p2, float& t);
 
 protected:
   Point2D m_p1, m_p2;
 };
 
+// Advance of GLUT_BITMAP_9_BY_15, the font all text is drawn in
+#define TEXT_CHAR_WIDTH 9
+
 /**
 * The text that can be displayed on the screen.
 */
@@ -0,0 +1,173 @@
+#ifndef __SIMULATION_H_
+#define __SIMULATION_H_
+
+#include <vector>
+#include <atomic>
+#include <string>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "Common.h"
+#include "Point.h"
+#include "stk/Thread.h"
+#include "stk/Mutex.h"
+
+class Engine;
+class Track;
+
+/**
+* Moves the pluckers on a thread of its own, in fixed steps of 1 / rate
+* seconds, so that plucks land on time however fast the window redraws.
+*
+* After every step the plucker positions are copied to the back one of two
+* buffers, which is then swapped to the front. Drawing interpolates between
+* the last two steps of the front buffer, i.e. it shows the scene one step
+* in the past.
+*
+* Event driven, it instead sleeps until the EventQueue says something is
+* about to happen, and only wakes otherwise to copy out positions as often
+* as the window redraws, or to start new pluckers.
+*
+* Pluckers are only ever started on the simulation thread, after the track
+* graph is brought up to date, since starting one can move and split the
+* others along its routes.
+*
+* In lockstep, steps are numbered from the epoch, so peers with synchronized
+* clocks agree on them, and new pluckers are stamped with the step they
+* start at instead of starting when the message arrives. Stepping is then
+* the same float operations in the same order everywhere, so peers hear the
+* same plucks without ever exchanging plucker state.
+*/
+class Simulation
+{
+public:
+  enum Mode
+  {
+    STEPPED,
+    EVENT_DRIVEN,
+    LOCKSTEP
+  };
+
+  Simulation(Engine* engine, double rate, Mode mode = STEPPED);
+  ~Simulation();
+
+  /**
+  * Starts stepping in real time
+  */
+  void start();
+  void stop();
+  /**
+  * Advances by one step now, for offline rendering without the thread
+  */
+  void step();
+
+  /**
+  * Fills positions with where the pluckers are to be drawn right now
+  */
+  void getPluckerPositions(std::vector<Point2D>& positions);
+
+  double getRate() { return m_rate; }
+  bool isLockstep() { return m_mode == LOCKSTEP; }
+
+  /**
+  * Starts a plucker on track at the next step, or event driven as soon as
+  * the simulation thread wakes, which it is woken to do. Scene lock held.
+  */
+  void addPlucker(Track* track);
+  /**
+  * Lockstep: the step local input should take effect at, late enough for
+  * it to reach the peers first. Scene lock held.
+  */
+  unsigned long long getInputTick();
+  /**
+  * Lockstep: starts a plucker on track at the given step, or at the next
+  * one if that has passed already. Scene lock held.
+  */
+  void queuePlucker(Track* track, unsigned long long tick);
+
+  /**
+  * Serializes changes to the widget tree between the GUI, network and
+  * simulation threads. Hold it around anything that changes widgets.
+  *
+  * Drawing and stepping only share it, so a slow frame doesn't hold up the
+  * steps. Stepping does change things under the shared lock, though:
+  * - the pluckers and their tracks' times
+  * - the TrackGraph and the EventQueue
+  * - each Track's cached string crossings
+  * - the queued inputs and the step count
+  * Drawing must not read any of these; it takes the pluckers from the
+  * snapshot instead. Either way, unlock with unlockScene().
+  */
+  static void lockScene() { pthread_rwlock_wrlock(&s_sceneLock); }
+  static void lockSceneShared() { pthread_rwlock_rdlock(&s_sceneLock); }
+  static void unlockScene() { pthread_rwlock_unlock(&s_sceneLock); }
+
+  /**
+  * When the step being run was due, which its plucks are timed from. The
+  * simulation thread only.
+  */
+  static double getStepTime() { return s_stepTime; }
+
+private:
+  struct PluckerState
+  {
+    PluckerState(Point2D previous, Point2D current) : previous(previous), current(current) {}
+    Point2D previous, current;
+  };
+
+  struct PluckerInput
+  {
+    unsigned long long tick;
+    std::string track; // UUID
+
+    // By step, and within a step by track, as every peer sorts them
+    bool operator<(const PluckerInput& other) const {
+      return tick != other.tick ? tick < other.tick : track < other.track;
+    }
+  };
+
+  /**
+  * Starts the queued pluckers that are due. Scene lock held.
+  */
+  void applyInputs();
+  /**
+  * Lockstep: numbers the next step from the wall clock, and returns how
+  * long until it is due
+  */
+  double syncTick();
+
+  static void* run(void* simulation);
+  static void* runEvents(void* simulation);
+  void step(double time);
+  /**
+  * Fills the back buffer from the pluckers, as they are now and period
+  * seconds before. Scene lock held.
+  */
+  void collect(double period);
+  void swap(double time, double period);
+
+  Engine* m_engine;
+  double m_rate;
+  Mode m_mode;
+  stk::Thread m_thread;
+  std::atomic<bool> m_fRunning;
+  sem_t m_wake; // Posted to wake the event driven thread early
+
+  // Changed under the scene lock
+  unsigned long long m_tick;          // Number of the next step
+  std::vector<PluckerInput> m_inputs;
+
+  // Double-buffered plucker states, swapped under m_snapshotMutex
+  std::vector<PluckerState> m_snapshots[2];
+  unsigned int m_front;
+  double m_snapshotTime;   // When the front buffer's step was due
+  double m_snapshotPeriod; // And how long before that its previous positions were
+  std::vector<float> m_s;  // Scratch for the previous positions
+  std::vector<Point2D> m_positions;
+  stk::Mutex m_snapshotMutex;
+
+  static pthread_rwlock_t s_sceneLock;
+  static double s_stepTime;
+};
+
+#endif
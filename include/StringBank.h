@@ -0,0 +1,104 @@
+#ifndef __STRING_BANK_H_
+#define __STRING_BANK_H_
+
+#include <set>
+#include <atomic>
+
+#include "Common.h"
+#include "stk/Mutex.h"
+
+/**
+* Karplus-Strong strings for many voices at once, laid out as structure of
+* arrays so 4 (SSE) or 8 (AVX) strings are processed per instruction. The
+* model is the one in stk::Plucked, in single precision.
+*
+* Voices are handed out and released by the engine threads; everything
+* else belongs to the audio thread. A voice handle carries a generation, so
+* a stale handle never reaches a reused voice.
+*/
+class StringBank
+{
+public:
+  static const unsigned int INVALID_VOICE = 0xffffffff;
+
+  StringBank(unsigned int maxVoices, float lowestFrequency, unsigned int maxFrames);
+  ~StringBank();
+
+  // Engine threads
+  unsigned int allocate();
+  void release(unsigned int voice);
+  unsigned int getVoiceCount() { return m_numAllocated.load(); }
+
+  // Audio thread
+  /**
+  * Plucks a voice offset frames into the next rendered buffer
+  */
+  void schedulePluck(unsigned int voice, unsigned int offset, float frequency, float amplitude);
+  /**
+  * Adds the next nFrames of all awake voices to out, one sample every stride entries
+  */
+  void tick(SAMPLE* out, unsigned int nFrames, unsigned int stride = 1);
+  unsigned int getActiveCount() { return m_numAwake; }
+
+  /**
+  * tick() in pieces, so ranges of voice groups can render on different
+  * threads. Between beginBuffer and endBuffer, each group must be rendered
+  * by exactly one call to renderGroups. mix holds getMixSize() floats,
+  * zeroed by the caller, and goes to the output through mixDown.
+  */
+  unsigned int beginBuffer(unsigned int nFrames); // Returns the number of groups
+  void renderGroups(unsigned int first, unsigned int last, float* mix);
+  void endBuffer();
+  void mixDown(const float* mix, SAMPLE* out, unsigned int nFrames, unsigned int stride);
+  unsigned int getMixSize() { return m_maxFrames * getLanes(); }
+  static unsigned int getLanes();
+
+private:
+  struct Pluck
+  {
+    unsigned int voice, offset;
+    float frequency, amplitude;
+    int next; // Next pluck for the same group, or -1
+  };
+
+  void renderGroup(unsigned int group, unsigned int start, unsigned int end, float* mix);
+  void applyPluck(const Pluck& pluck);
+  void resetVoice(unsigned int index);
+  void stepDelay(unsigned int index, float input);
+  void setAwake(unsigned int index, bool fAwake);
+  float nextNoise(unsigned int index);
+
+  unsigned int m_maxVoices, m_numGroups, m_maxFrames;
+  unsigned int m_length, m_mask; // Delay line length, a power of two
+  float m_sampleRate;
+  unsigned int m_holdFrames;
+
+  // Engine side bookkeeping
+  stk::Mutex m_allocMutex;
+  std::set<unsigned int> m_free;     // Lowest first, to keep voices packed
+  unsigned int* m_generations;
+  std::atomic<unsigned int>* m_liveVoices; // Handle currently owning each index
+  std::atomic<unsigned int> m_numAllocated, m_highWater;
+
+  // Per voice state, one entry per lane
+  float* m_lines;
+  float *m_lastOut, *m_apInput, *m_filterIn, *m_loopGain, *m_coeff;
+  float *m_pickState, *m_peak;
+  unsigned int *m_inPoint, *m_outPoint;
+  unsigned int *m_voices;      // Handle each index was last set up for
+  unsigned int *m_quietFrames;
+  unsigned int *m_noise;       // Per voice, so groups can pluck in parallel
+  bool* m_awake;
+  unsigned int* m_groupAwake;
+  unsigned int m_numAwake;
+
+  // Plucks for the next buffer, chained per group
+  Pluck m_plucks[MAX_PENDING_PLUCKS];
+  unsigned int m_numPlucks;
+  int *m_groupFirst, *m_groupLast;
+
+  unsigned int m_nFrames, m_tickGroups; // Size of the buffer being rendered
+  float* m_mix; // Lane-wise sums for each frame of the buffer
+};
+
+#endif
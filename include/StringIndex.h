@@ -0,0 +1,73 @@
+#ifndef __STRING_INDEX_H_
+#define __STRING_INDEX_H_
+
+#include <vector>
+
+#include "Common.h"
+#include "Point.h"
+
+class String;
+
+/**
+* A string crossed by a plucker, t of the way along its step
+*/
+struct StringCrossing
+{
+  String* string;
+  float t;
+};
+
+/**
+* The strings on a pad, binned by the angle they cover around the pad's
+* center. Strings are drawn along radii, so each one usually falls in a
+* single bin, as does a plucker's step. A segment passing (almost) through
+* the center covers every angle and is checked against everything.
+*
+* The end points are copied in, so lookups don't touch the strings.
+*/
+class StringIndex
+{
+public:
+  StringIndex(Point2D center);
+
+  void insert(String* string);
+  void remove(String* string);
+
+  /**
+  * Appends every string the segment from -> to crosses to crossings
+  */
+  void findCrossings(Point2D from, Point2D to, std::vector<StringCrossing>& crossings);
+
+  unsigned int size() { return m_numStrings; }
+  /**
+  * Goes up whenever any index gains or loses a string
+  */
+  static unsigned int getVersion() { return s_version; }
+
+private:
+  struct Entry
+  {
+    String* string;
+    unsigned int slot;
+    Point2D p1, p2;
+  };
+
+  /**
+  * First and last bin the segment covers, wrapping around; false if it
+  * passes by the center and so covers them all
+  */
+  bool getBins(Point2D p1, Point2D p2, unsigned int& first, unsigned int& last);
+  void findCrossings(const std::vector<Entry>& entries, Point2D from, Point2D to,
+                     std::vector<StringCrossing>& crossings);
+
+  Point2D m_center;
+  std::vector<Entry> m_bins[STRING_INDEX_BINS];
+  std::vector<Entry> m_central;
+  unsigned int m_numStrings;
+  // Bit per string slot, set for the strings found so far by a lookup
+  std::vector<unsigned int> m_found;
+
+  static unsigned int s_version;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __TRACK_GRAPH_H_
+#define __TRACK_GRAPH_H_
+
+#include <vector>
+
+class Widget;
+class Track;
+class Joint;
+
+/**
+* The joints and tracks, compiled for routing pluckers. For each end of
+* each track it lists, side by side in one array, the tracks a plucker
+* arriving there carries on along, and which way.
+*
+* Anything that changes which tracks are in the scene or how they connect
+* calls invalidate(), and the next simulation step compiles it again.
+* Compiling is one pass over the tracks and their joints, and editing
+* changes connections rarely, so the graph is compiled whole each time
+* instead of patched in place. Scene lock held throughout.
+*/
+class TrackGraph
+{
+public:
+  struct Route
+  {
+    Track* track;
+    Joint *startJoint, *endJoint;
+  };
+
+  static void invalidate() { s_fChanged = true; }
+  /**
+  * invalidate()s if widget is a track or has any under it, e.g. when it is
+  * added to or taken out of the scene
+  */
+  static void invalidate(Widget* widget);
+  /**
+  * Recompiles from the tracks under root, if anything changed
+  */
+  static void update(Widget* root);
+
+  /**
+  * Sets [first, last) to the routes out of the given end of track
+  */
+  static void getRoutes(Track* track, bool fAtJoint1, const Route*& first, const Route*& last);
+
+  /**
+  * Every track in the scene as of the last update(), in UUID order so that
+  * peers go through them alike, and which update that was
+  */
+  static const std::vector<Track*>& getTracks() { return s_tracks; }
+  static unsigned int getVersion() { return s_version; }
+
+private:
+  static void collectTracks(Widget* widget);
+  static bool hasTracks(Widget* widget);
+
+  static bool s_fChanged;
+  static unsigned int s_version;
+  static std::vector<Track*> s_tracks;
+  static std::vector<unsigned int> s_offsets; // Two per track, plus one
+  static std::vector<Route> s_routes;
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <atomic>
 
 #include "stk/Mutex.h"
 
@@ -19,9 +20,17 @@ class LineTrack;
 class String;
 
 #include "Shape.h"
+#include "Plucker.h"
+#include "StringIndex.h"
+#include "TrackGraph.h"
+#include "EventQueue.h"
+#include "SceneIndex.h"
+#include "JointIndex.h"
+#include "WidgetRegistry.h"
 #include "include/Common.h"
+#include "include/PluckQueue.h"
 #include "osc/OscOutboundPacketStream.h"
-#include "stk/Plucked.h"
+#include "StringBank.h"
 
 typedef std::map<std::string, Widget*> WidgetMap;
 typedef std::pair<std::string, Widget*> WidgetData;
@@ -29,11 +38,19 @@ typedef std::pair<std::string, Widget*> WidgetData;
 typedef std::map<std::string, SoundSource*> SoundSourceMap;
 typedef std::pair<std::string, SoundSource*> SoundSourceData;
 
+/**
+* An immutable, flat snapshot of the sound sources that the audio thread renders
+*/
+struct SoundSourceList
+{
+  unsigned long version;
+  std::vector<SoundSource*> sources;  // The rendered ones, sorted by id for pluck routing
+  std::vector<SoundSource*> rendered; // The ones that render through tick()
+};
+
 #define LEFT_SIDE -1
 #define RIGHT_SIDE 1
 typedef int Side;
-typedef std::map<std::string, Side> StringStateMap;
-typedef std::pair<std::string, Side> StringStateData;
 
 /**
 * The base class of all components who want to deal with all user interaction
@@ -58,7 +75,21 @@ public:
   virtual bool onMouseOver(float x, float y);
 
   virtual void draw() = 0;
+  /**
+  * Returns the widget if (x, y) is on it. Only answers; it must not change
+  * anything, hover highlighting included.
+  */
   virtual Widget *hitTest(float x, float y) { return NULL; }
+  /**
+  * The box hitTest() stays within; false if there is none, and so the
+  * widget may be hit anywhere
+  */
+  virtual bool getBounds(Point2D& min, Point2D& max) { return false; }
+  /**
+  * Advances the simulation by dt seconds. Runs on the simulation thread,
+  * so it must not touch anything that drawing reads.
+  */
+  virtual void simulate(float dt);
 
   virtual void setParent(Widget *parent);
   virtual void setNetwork(Network *network);
@@ -77,6 +108,17 @@ public:
 
   virtual Widget* getEngine();
 
+  // When the scene index last found this widget
+  void setSceneVersion(unsigned int version) { m_sceneVersion = version; }
+  unsigned int getSceneVersion() const { return m_sceneVersion; }
+
+  WidgetType getType() const { return m_type; }
+  bool isTrack() const { return m_type == WIDGET_SPIRAL_TRACK || m_type == WIDGET_LINE_TRACK; }
+  // The widget registry's list of widgets of the same type
+  Widget* getPrevOfType() const { return m_prevOfType; }
+  Widget* getNextOfType() const { return m_nextOfType; }
+  void setTypeLinks(WidgetType type, Widget* prev, Widget* next) { m_type = type; m_prevOfType = prev; m_nextOfType = next; }
+
 protected:
   /**
   * The draw event called when the user drags from this widget
@@ -99,10 +141,13 @@ protected:
 
   std::vector<Widget *> m_children;
   Widget *m_parent, *m_engine;
-  Widget *m_mouseDownOn;
+  WidgetHandle m_mouseDownOn; // Can be deleted by a peer mid-drag
   bool m_fLeftButtonDown, m_fRightButtonDown;
   Point2D m_mouseDownPos, m_drawStartPos;
-  std::string m_uuid;
+  mutable std::string m_uuid; // Generated on first use
+  unsigned int m_sceneVersion;
+  WidgetType m_type;
+  Widget *m_prevOfType, *m_nextOfType;
 
   static Network *s_network;
 };
@@ -113,6 +158,10 @@ protected:
 class Joint : public Widget
 {
 public:
+  // Allocated from the widget registry's arena for joints
+  static void* operator new(size_t size) { return WidgetRegistry::allocate(WIDGET_JOINT, size); }
+  static void operator delete(void* p) { WidgetRegistry::free(WIDGET_JOINT, p); }
+
   Joint(Point2D center, float radius);
   ~Joint();
 
@@ -124,10 +173,16 @@ public:
 
   virtual void draw();
   virtual Widget *hitTest(float x, float y);
+  virtual bool getBounds(Point2D& min, Point2D& max);
   virtual std::string toString();
   RoundPad *getParentRoundPad() { return m_parentRoundPad; }
   void setParentRoundPad(RoundPad *pad) { m_parentRoundPad = pad; }
 
+  // Where JointIndex keeps this joint
+  bool isIndexed() { return m_fIndexed; }
+  long long getIndexKey() { return m_indexKey; }
+  void setIndexKey(bool fIndexed, long long key) { m_fIndexed = fIndexed; m_indexKey = key; }
+
 protected:
   virtual bool handleDraw(float x, float y);
   virtual bool handleDrawEnd(float x, float y);
@@ -136,7 +191,7 @@ protected:
   std::vector<Track *> m_tracks;
   Point2D m_center;
   float m_radius;
-  Spiral *m_circle;
+  Spiral m_circle;
 
   SpiralTrack* m_newSpiralTrack;
   LineTrack* m_newLineTrack;
@@ -144,6 +199,20 @@ protected:
   bool m_drawing;
 
   RoundPad *m_parentRoundPad;
+
+  bool m_fIndexed;
+  long long m_indexKey;
+};
+
+/**
+* A string crossing a track, s along it from joint 1
+*/
+struct TrackCrossing
+{
+  float s;
+  String* string;
+
+  bool operator<(const TrackCrossing& other) const { return s < other.s; }
 };
 
 /**
@@ -162,28 +231,111 @@ public:
   Joint *getJoint1() { return m_joint1; }
   Joint *getJoint2() { return m_joint2; }
   /**
-  * Returns the next position on the track that is distance far away from the passed in position
+  * Length of the track, from joint 1 to joint 2
+  */
+  float getLength() { return m_length; }
+  /**
+  * Returns the point s along the track from joint 1
+  */
+  virtual Point2D getPosition(float s) = 0;
+  /**
+  * getPosition() for n points at once
+  */
+  virtual void getPositions(const float* s, Point2D* positions, unsigned int n) = 0;
+  /**
+  * Starts a plucker at joint 1. Off the simulation thread, once it runs, go
+  * through Simulation::addPlucker() instead.
   */
-  virtual Point2D getNextPos(bool fReverse, float distance, Point2D pos) = 0;
   void addPlucker();
+  /**
+  * Starts a plucker of the given weight at startJoint, or merges it into one
+  * already there going the same way. If the track is full it is dropped.
+  */
+  void addPlucker(Joint *startJoint, unsigned int weight);
+  /**
+  * Pluckers are owned by the simulation thread, not drawn as children
+  */
+  const PluckerArrays* getPluckers() { return &m_pluckers; }
+
+  // Overrides Widget, to put the joints in the joint index once in the scene
+  virtual void setParent(Widget *parent);
 
-  void setEnabled(bool fEnabled) { m_fEnabled = fEnabled; }
+  // Overrides Widget. Pluckers that reach an end stay there until
+  // splitArrivals(), so that no track sees the others' splits mid-step.
+  virtual void simulate(float dt);
+  void splitArrivals();
+
+  /**
+  * Where the strings of the pads at either end cross the track, in order
+  */
+  const std::vector<TrackCrossing>& getCrossings();
+  /**
+  * Event driven mode: moves the pluckers on to time, plucking and splitting
+  * on the way. Does nothing if the track is there already. Simulation
+  * thread only, as splitting follows the track graph's routes.
+  */
+  void syncTo(double time);
+  /**
+  * Sets when the pluckers are where they are, without moving them
+  */
+  void setTime(double time) { m_time = time; }
+  /**
+  * When a plucker next crosses a string or reaches an end, or DBL_MAX if
+  * there are no pluckers
+  */
+  double predictEvent();
+  unsigned int nextEventSerial() { return ++m_eventSerial; }
+  unsigned int getEventSerial() { return m_eventSerial; }
+
+  // Only the changes that reroute pluckers invalidate the track graph
+  void setEnabled(bool fEnabled) { if (fEnabled != m_fEnabled) TrackGraph::invalidate(); m_fEnabled = fEnabled; }
   void setActive(bool fActive) { m_fActive = fActive; }
-  void setDirected(bool fDirected) { m_fDirected = fDirected; }
+  void setDirected(bool fDirected) { if (fDirected != m_fDirected) TrackGraph::invalidate(); m_fDirected = fDirected; }
   void setImmediate(bool fImmediate) { m_fImmediate = fImmediate; }
-  void setJoints(Joint *j1, Joint *j2) { m_joint1 = j1; m_joint2 = j2; }
+  void setJoints(Joint *j1, Joint *j2) { if (j1 != m_joint1 || j2 != m_joint2) TrackGraph::invalidate(); m_joint1 = j1; m_joint2 = j2; }
   bool isEnabled() { return m_fEnabled; }
   bool isActive() { return m_fActive; }
   bool isDirected() { return m_fDirected;}
   bool isImmediate() { return  m_fImmediate; }
 
+  // Where the track graph last compiled this track
+  void setGraphIndex(unsigned int version, unsigned int index) { m_graphVersion = version; m_graphIndex = index; }
+  bool isInGraph(unsigned int version) { return m_graphVersion == version; }
+  unsigned int getGraphIndex() { return m_graphIndex; }
+
 protected:
-  virtual void drawChildren();
   virtual void detachJoint(Joint *joint);
   void setupJoints(Joint *joint1, Joint *joint2); 
+  /**
+  * Plucks the strings each plucker crossed in the last dt seconds
+  */
+  void pluckStrings(float dt);
+  /**
+  * Starts the plucker that just reached an end on the tracks that lead on
+  */
+  void split(unsigned int i);
+  /**
+  * The string indices of the pads at either end, NULL where there is no
+  * pad or both ends share one
+  */
+  void getStringIndices(StringIndex *index[2]);
+  /**
+  * Call when the track changes shape
+  */
+  void invalidateCrossings();
 
   Joint *m_joint1, *m_joint2; // Start joint and end joint
   bool m_fEnabled, m_fActive, m_fDirected, m_fImmediate;
+  float m_length;
+  PluckerArrays m_pluckers;
+  unsigned int m_graphVersion, m_graphIndex;
+
+  // Event driven mode
+  double m_time;                          // When the pluckers were where they are
+  unsigned int m_eventSerial;             // Of the event last queued
+  std::vector<TrackCrossing> m_crossings;
+  bool m_fCrossingsValid;
+  unsigned int m_crossingsVersion;        // StringIndex version they were found at
 };
 
 /**
@@ -192,6 +344,10 @@ protected:
 class SpiralTrack : public Track
 {
 public:
+  // Allocated from the widget registry's arena for spiral tracks
+  static void* operator new(size_t size) { return WidgetRegistry::allocate(WIDGET_SPIRAL_TRACK, size); }
+  static void operator delete(void* p) { WidgetRegistry::free(WIDGET_SPIRAL_TRACK, p); }
+
   SpiralTrack(Point2D center, float startAngle, float startRadius,
                               float endAngle, float endRadius, Joint *joint1, Joint *joint2);
   ~SpiralTrack();
@@ -201,12 +357,14 @@ public:
 
   virtual void draw();
   virtual Widget *hitTest(float x, float y);
+  virtual bool getBounds(Point2D& min, Point2D& max);
 
   virtual void toOutboundPacketStream(osc::OutboundPacketStream&) const;
 
   virtual Point2D getEndPoint1();
   virtual Point2D getEndPoint2();
-  virtual Point2D getNextPos(bool fReverse, float distance, Point2D pos);
+  virtual Point2D getPosition(float s);
+  virtual void getPositions(const float* s, Point2D* positions, unsigned int n);
 
   Point2D getCenter();
   void setCenter(const Point2D& center);
@@ -222,10 +380,17 @@ public:
   virtual std::string toString();
 
 protected:
+  /**
+  * Samples the spiral at even steps of arc length, for getPosition()
+  */
+  void buildTable();
+
   Point2D m_center;
   float m_startRadius, m_endRadius;
   float m_startAngle, m_endAngle;
   Spiral *m_spiral;
+  std::vector<Point2D> m_table; // Relative to the center, TRACK_TABLE_SPACING or less apart
+  float m_tableScale;           // Table entries per unit of arc length
 };
 
 /**
@@ -234,6 +399,10 @@ protected:
 class LineTrack : public Track
 {
 public:
+  // Allocated from the widget registry's arena for line tracks
+  static void* operator new(size_t size) { return WidgetRegistry::allocate(WIDGET_LINE_TRACK, size); }
+  static void operator delete(void* p) { WidgetRegistry::free(WIDGET_LINE_TRACK, p); }
+
   LineTrack(Point2D p1, Point2D p2, Joint *joint1, Joint *joint2);
   ~LineTrack();
 
@@ -241,12 +410,14 @@ public:
 
   virtual void draw();
   virtual Widget *hitTest(float x, float y);
+  virtual bool getBounds(Point2D& min, Point2D& max);
 
   virtual void toOutboundPacketStream(osc::OutboundPacketStream&) const;
 
   virtual Point2D getEndPoint1() { return m_p1; }
   virtual Point2D getEndPoint2() { return m_p2; }
-  virtual Point2D getNextPos(bool fReverse, float distance, Point2D pos);
+  virtual Point2D getPosition(float s);
+  virtual void getPositions(const float* s, Point2D* positions, unsigned int n);
 
   virtual bool handleHover(float x, float y);
 
@@ -255,63 +426,119 @@ public:
 protected:
   Line *m_line;
   Point2D m_p1, m_p2;
+  Point2D m_direction; // Unit vector from p1 to p2
 };
 
 /**
-* The component that travels along the tracks and makes sound when it passes a string 
+* The base class for all the components that want to make sound
 */
-class Plucker : public Widget
+class SoundSource : public Widget
 {
 public:
-  Plucker(Track *track, Joint *startJoint, Joint *endJoint);
-  ~Plucker();
+  SoundSource();
 
+  static void initializeGlobals();
   /**
-  * When the plucker is at an end joint, call this function to put more pluckers on the tracks following the current one.
+  * Adds or removes a source from the engine side set. The audio thread only
+  * touches sources that it renders, and removing one of those waits until
+  * it can no longer be rendering it; others are gone at once.
   */
-  std::vector<Plucker *> split();
-  bool isAtEnd();
-
+  static void addGlobal(SoundSource*);
+  static void removeGlobal(SoundSource*);
+  static bool hasGlobal(const std::string& uuid);
   /**
-  * Proceed the plucker to the next position along the track
+  * Hands a new snapshot to the audio thread if the engine side set changed
   */
-  void tick();
-  virtual void draw();
-
-  Point2D getPos() { return m_pos; }
-
-  Side getSideOfString(String*);
-  Side updateSideOfString(String*);
-
-private:
-  Track *m_track;
-  Joint *m_startJoint, *m_endJoint;
-  Point2D m_pos;
-  Spiral *m_circle;
+  static void publishGlobals();
+  /**
+  * Wait-free access to the latest snapshot, for the audio thread only.
+  * Every acquire must be matched by a release once rendering is done.
+  */
+  static const SoundSourceList* acquireForAudio();
+  static void releaseForAudio();
+  /**
+  * Number of sources rendered versus published in the last audio buffer
+  */
+  static void setVoiceCounts(unsigned int active, unsigned int total);
+  static unsigned int getActiveVoiceCount() { return s_activeVoices.load(); }
+  static unsigned int getTotalVoiceCount() { return s_totalVoices.load(); }
 
-  StringStateMap m_stringStates;
-};
+  /**
+  * Moves the stream clock on by one buffer and returns the buffer's first
+  * frame. Called by the audio thread before rendering.
+  */
+  static unsigned long long advanceClock(unsigned int nFrames);
+  /**
+  * Returns the stream frame at which a pluck due at the given Clock time
+  * should sound
+  */
+  static double getPluckFrame(double time);
+  /**
+  * Offline rendering has no wall clock to follow: plucks then land at the
+  * start of the buffer after the one last rendered
+  */
+  static void setRealtimeClock(bool fRealtime) { s_fRealtimeClock = fRealtime; }
+  /**
+  * Queues a pluck for the audio thread, from any thread
+  */
+  static void queuePluck(const PluckEvent&);
+  /**
+  * Hands every queued pluck that falls in the buffer starting at frame to
+  * its source. Audio thread only.
+  */
+  static void dispatchPlucks(const SoundSourceList*, unsigned long long frame, unsigned int nFrames);
 
-/**
-* The base class for all the components that want to make sound
-*/
-class SoundSource : public Widget
-{
-public:
-  static void initializeGlobals();
-  static void lockGlobals();
-  static void unlockGlobals();
-  static void swapGlobals();
-  static SoundSourceMap* getAllForAudio();
-  static SoundSourceMap* getAllForEngine();
+  unsigned int getSourceId() const { return m_sourceId; }
   /**
   * Returns the current sound signal and proceed to the next time unit
   */
   virtual SAMPLE tick() { return 0.0f; }
+  /**
+  * Adds the next nFrames of sound signal to out, one sample every stride entries
+  */
+  virtual void tick(SAMPLE* out, unsigned int nFrames, unsigned int stride = 1);
+  /**
+  * Returns true if the source is silent and the audio thread can skip it
+  */
+  virtual bool isSleeping() { return false; }
+  /**
+  * Returns false for sources whose sound is made elsewhere, like strings in the bank
+  */
+  virtual bool isRendered() { return true; }
+  /**
+  * Applies a pluck offset frames into the next rendered buffer. Audio thread only.
+  */
+  virtual void schedulePluck(const PluckEvent&, unsigned int offset) {}
+
+protected:
+  unsigned int m_sourceId;
 
 private:
-  static SoundSourceMap *s_forAudio, *s_forEngine;
-  static stk::Mutex s_swapMutex;
+  static void publishLocked();
+  static void reclaimLocked(bool wait);
+
+  static SoundSourceMap s_forEngine;
+  static bool s_fDirty;
+  static unsigned long s_version;
+  static std::vector<std::pair<SoundSourceList*, unsigned long> > s_retired;
+  static stk::Mutex s_engineMutex;
+
+  static std::atomic<SoundSourceList*> s_forAudio;
+  static std::atomic<unsigned long> s_audioEpoch; // Odd while the audio thread renders
+  static std::atomic<unsigned int> s_activeVoices, s_totalVoices;
+
+  static std::atomic<unsigned int> s_nextSourceId;
+  static PluckQueue s_plucks;
+  static PluckEvent s_pendingPlucks[MAX_PENDING_PLUCKS]; // Audio thread only
+  static unsigned int s_numPendingPlucks;
+
+  // Stream clock, written by the audio thread under a sequence lock
+  static std::atomic<unsigned int> s_clockSeq;
+  static std::atomic<unsigned long long> s_clockFrame;
+  static std::atomic<double> s_clockTime;
+  static std::atomic<unsigned int> s_clockBufferSize;
+  static unsigned long long s_nextFrame;
+  static bool s_fRealtimeClock;
 };
 
 /**
@@ -320,14 +547,23 @@ private:
 class String : public SoundSource
 {
 public:
+  // Allocated from the widget registry's arena for strings
+  static void* operator new(size_t size) { return WidgetRegistry::allocate(WIDGET_STRING, size); }
+  static void operator delete(void* p) { WidgetRegistry::free(WIDGET_STRING, p); }
+
   String(Point2D p1, Point2D p2, float radius);
   ~String();
 
   void initialize(Point2D p1, Point2D p2, float radius);
-  bool pluck(Plucker *plucker);
+  /**
+  * Plucks the string now, or so that it sounds at the given Clock time
+  */
+  bool pluck();
+  bool pluckAt(double time, float amplitude = 1);
 
   // Overrides Widget
   virtual Widget *hitTest(float x, float y);
+  virtual bool getBounds(Point2D& min, Point2D& max);
   virtual void draw();
   virtual bool handleHover(float x, float y);
 
@@ -335,10 +571,21 @@ public:
 
   void setPadRadius(float);
 
-  // Overrides SoundSource
-  virtual SAMPLE tick();
+  /**
+  * Creates the bank all strings sound in. Call once the sample rate is set.
+  */
+  static void initializeBank();
+  static StringBank* getBank() { return s_bank; }
+
+  // Overrides SoundSource. Plucks go straight to the bank voice.
+  virtual bool isRendered() { return false; }
 
   Line* getLine();
+  /**
+  * Small index, unique among living strings and reused after they go
+  */
+  unsigned int getSlot() const { return m_slot; }
+  static unsigned int getSlotCount() { return s_numSlots; }
 
   Side getMouseSide(float, float);
   Side updateMouseSide(float, float);
@@ -347,10 +594,15 @@ protected:
   Line *m_line;           // Shape on GUI
   Point2D m_p1, m_p2;     // For determining the pitch
   Spiral *m_p1Dot, *m_p2Dot;
-  Plucker *m_lastPlucker;
   Side m_mouseSide;
-  stk::Plucked m_plucked; // stk string
+  unsigned int m_voice;    // Voice in the string bank
   float m_freq;           // Frequency to be plucked
+  unsigned int m_slot;
+
+  static StringBank* s_bank;
+  // Slots are handed out under the scene lock
+  static std::vector<unsigned int> s_freeSlots;
+  static unsigned int s_numSlots;
 };
 
 /**
@@ -359,6 +611,10 @@ protected:
 class RoundPad : public Widget
 {
 public:
+  // Allocated from the widget registry's arena for pads
+  static void* operator new(size_t size) { return WidgetRegistry::allocate(WIDGET_PAD, size); }
+  static void operator delete(void* p) { WidgetRegistry::free(WIDGET_PAD, p); }
+
   RoundPad(Point2D center, float radius);
   ~RoundPad();
 
@@ -368,6 +624,20 @@ public:
 
   virtual void draw();
   virtual Widget *hitTest(float x, float y);
+  virtual bool getBounds(Point2D& min, Point2D& max);
+
+  // Overrides Widget, to keep the string index up to date
+  virtual void addChild(Widget *child);
+  virtual Widget* removeChild(Widget *child);
+
+  /**
+  * The strings on this pad, for finding the ones a plucker crosses
+  */
+  StringIndex* getStringIndex() { return &m_stringIndex; }
+  /**
+  * The nearest joint at p of a track on this pad other than except, or NULL
+  */
+  Joint* findJoint(Point2D p, const Joint* except = NULL);
 
   virtual void toOutboundPacketStream(osc::OutboundPacketStream&) const;
 
@@ -390,6 +660,7 @@ protected:
   String* m_newString;
   std::vector<Spiral *> m_circles;
   std::vector<Track *> m_tracks;
+  StringIndex m_stringIndex;
 };
 
 #endif
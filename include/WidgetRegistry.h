@@ -0,0 +1,73 @@
+#ifndef __WIDGET_REGISTRY_H_
+#define __WIDGET_REGISTRY_H_
+
+#include <stddef.h>
+
+#include "Arena.h"
+
+class Widget;
+
+enum WidgetType
+{
+  WIDGET_OTHER,
+  WIDGET_PAD,
+  WIDGET_SPIRAL_TRACK,
+  WIDGET_LINE_TRACK,
+  WIDGET_JOINT,
+  WIDGET_STRING,
+  WIDGET_NUM_TYPES
+};
+
+/**
+* Names a widget without keeping a pointer to it, for references that may
+* outlive the widget, e.g. when a peer deletes it
+*/
+struct WidgetHandle
+{
+  WidgetType type;
+  Handle handle;
+
+  WidgetHandle() : type(WIDGET_OTHER) {}
+};
+
+/**
+* Every live pad, track, joint and string, in a list per type threaded
+* through the widgets themselves, so that looking for one kind of widget
+* doesn't mean casting every widget there is.
+*
+* Widgets add themselves when constructed and leave when deleted, whether
+* or not they are in the scene. Their memory comes from an arena per type,
+* through the classes' own operator new, so that each kind sits together
+* and can be named by generation checked handles. Scene lock held.
+*/
+class WidgetRegistry
+{
+public:
+  static void add(Widget* widget, WidgetType type);
+  static void remove(Widget* widget);
+
+  /**
+  * The newest widget of the type; follow getNextOfType() for the rest
+  */
+  static Widget* getFirst(WidgetType type) { return s_first[type]; }
+  static unsigned int getCount(WidgetType type) { return s_count[type]; }
+
+  /**
+  * For the operator new and delete of classes nothing derives from
+  */
+  static void* allocate(WidgetType type, size_t size);
+  static void free(WidgetType type, void* widget);
+
+  static WidgetHandle getHandle(const Widget* widget);
+  /**
+  * The widget the handle names, or NULL if it has been deleted
+  */
+  static Widget* get(WidgetHandle handle);
+
+private:
+  static Arena* s_arenas[WIDGET_NUM_TYPES];
+  static Widget* s_first[WIDGET_NUM_TYPES];
+  static unsigned int s_count[WIDGET_NUM_TYPES];
+};
+
+#endif
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <algorithm>
 using namespace std;
 
@@ -21,12 +22,18 @@ using namespace std;
 #endif
 
 #include "stk/Stk.h"
+#include "stk/FileWvOut.h"
 
 #include "Common.h"
 
 #include "MyAudio.h"
 #include "Engine.h"
 #include "Network.h"
+#include "RenderPool.h"
+#include "AudioStats.h"
+#include "Simulation.h"
+#include "Clock.h"
+#include "InputQueue.h"
 
 //-----------------------------------------------------------------------------
 // function prototypes
@@ -34,6 +41,9 @@ using namespace std;
 void initializeGfx();
 void initializeAudio();
 void initializeNetwork();
+void adaptBufferSize(int currTime);
+int renderOffline();
+void renderBuffer(SAMPLE* out, unsigned int nFrames);
 
 // OpenGL callback functions
 void idleFunc(int);
@@ -43,6 +53,12 @@ void keyboardFunc( unsigned char, int, int );
 void mouseFunc( int button, int state, int x, int y );
 void motionFunc(int x, int y);
 
+// Queued input, handled once per frame
+void processInput();
+void handleKey(unsigned char key, int x, int y);
+void handleButton(int button, int state, int x, int y);
+void handleMotion(int x, int y);
+
 int audioCallback(void * outputBuffer, void * inputBuffer,
                   unsigned int bufferSize, double streamTime,
                   RtAudioStreamStatus status, void * userData);
@@ -54,10 +70,26 @@ int audioCallback(void * outputBuffer, void * inputBuffer,
 
 int g_startTime;
 int g_prevTime;
+int g_statsLogTime;
+AudioStatsSnapshot g_loggedStats;
 
 // Audio settings
 int g_numChannels = 2;
+unsigned int g_sampleRate = MY_SRATE;
+unsigned int g_bufferSize = BUFFER_SIZE;
+int g_audioDevice = -1; // Default device
+bool g_fOutputOnly = false;
+bool g_fAdaptiveBuffer = false;
+int g_adaptTime;
+int g_stablePeriods = 0;
+AudioStatsSnapshot g_adaptedStats;
 MyAudio *g_pAudio;
+RenderPool *g_pRenderPool = NULL;
+int g_renderThreads = 1;
+
+// Offline rendering, when an output file is given
+std::string g_outputFile;
+double g_renderSeconds = 60;
 
 // width and height
 GLsizei g_width = 512;
@@ -78,6 +110,9 @@ Point3D g_rotation, g_previousRotation;
 // Program objects
 Engine *g_pEngine = NULL;
 Network *g_pNetwork = NULL;
+Simulation *g_pSimulation = NULL;
+double g_simRate = SIMULATION_RATE;
+Simulation::Mode g_simMode = Simulation::STEPPED;
 
 // Network ports
 int g_port = DEFAULT_PORT,
@@ -87,18 +122,129 @@ std::string g_peerHost;
 void usage( int argc, char ** argv )
 {
   std::cerr << "Usage: " << argv[0]
+            << " [ <audio options> ]"
             << " <peer-hostname>[ :<peer-port = " << DEFAULT_PORT << "> ]"
-            << " [ <listen-port = " << DEFAULT_PORT << "> ]" << std::endl;
+            << " [ <listen-port = " << DEFAULT_PORT << "> ]" << std::endl
+            << "       " << argv[0]
+            << " [ <audio options> ] -o <output.wav> [ -l <seconds = 60> ]" << std::endl
+            << "       " << argv[0] << " -d list" << std::endl
+            << "Audio options:" << std::endl
+            << "  -d <device id>        audio device, see -d list (default device)" << std::endl
+            << "  -r <sample rate>      in Hz (" << MY_SRATE << ")" << std::endl
+            << "  -b <buffer size>      in frames (" << BUFFER_SIZE << ")" << std::endl
+            << "  -c <channels>         output channels (2)" << std::endl
+            << "  -O                    output only, don't open the input" << std::endl
+            << "  -a                    adapt the buffer size to the measured load" << std::endl
+            << "  -t <render threads>   (1)" << std::endl
+            << "  -s <simulation rate>  steps per second (" << SIMULATION_RATE << ")" << std::endl
+            << "  -e                    sleep between plucker events instead of stepping" << std::endl
+            << "  -k                    lockstep with the peers; needs synchronized clocks" << std::endl
+            << "  -p <max pluckers>[:<per track>]  (" << MAX_PLUCKERS << ":" << MAX_TRACK_PLUCKERS << ")" << std::endl;
   exit(1);
 }
 
 void parseCommandLine( int argc, char ** argv )
 {
-  if (argc < 2) {
+  int opt;
+  while ((opt = getopt(argc, argv, "t:s:ekp:o:l:d:r:b:c:Oa")) != -1) {
+    switch (opt) {
+      case 't':
+        g_renderThreads = atoi(optarg);
+        if (g_renderThreads <= 0 || g_renderThreads > MAX_RENDER_THREADS) {
+          std::cerr << "invalid number of render threads -- " << optarg << std::endl;
+          usage(argc, argv);
+        }
+        break;
+      case 's':
+        g_simRate = atof(optarg);
+        if (g_simRate < 1 || g_simRate > 100000) {
+          std::cerr << "invalid simulation rate -- " << optarg << std::endl;
+          usage(argc, argv);
+        }
+        break;
+      case 'e':
+        g_simMode = Simulation::EVENT_DRIVEN;
+        break;
+      case 'k':
+        g_simMode = Simulation::LOCKSTEP;
+        break;
+      case 'p': {
+        std::string limits(optarg);
+        std::string::size_type sepPos = limits.find(':');
+        int maxTotal = atoi(limits.substr(0, sepPos).c_str()),
+            maxPerTrack = sepPos != string::npos ? atoi(limits.substr(sepPos + 1).c_str()) : MAX_TRACK_PLUCKERS;
+        if (maxTotal <= 0 || maxPerTrack <= 0) {
+          std::cerr << "invalid plucker limits -- " << optarg << std::endl;
+          usage(argc, argv);
+        }
+        Plucker::setLimits(maxTotal, maxPerTrack);
+        break;
+      }
+      case 'd':
+        if (std::string(optarg) == "list") {
+          MyAudio::listDevices();
+          exit(0);
+        }
+        g_audioDevice = atoi(optarg);
+        if (g_audioDevice < 0) {
+          std::cerr << "invalid audio device -- " << optarg << std::endl;
+          usage(argc, argv);
+        }
+        break;
+      case 'r':
+        g_sampleRate = atoi(optarg);
+        if (g_sampleRate < 8000 || g_sampleRate > 192000) {
+          std::cerr << "invalid sample rate -- " << optarg << std::endl;
+          usage(argc, argv);
+        }
+        break;
+      case 'b':
+        g_bufferSize = atoi(optarg);
+        if (g_bufferSize < MIN_BUFFER_FRAMES || g_bufferSize > MAX_BUFFER_FRAMES) {
+          std::cerr << "invalid buffer size -- " << optarg << std::endl;
+          usage(argc, argv);
+        }
+        break;
+      case 'c':
+        g_numChannels = atoi(optarg);
+        if (g_numChannels <= 0 || g_numChannels > MAX_CHANNELS) {
+          std::cerr << "invalid number of channels -- " << optarg << std::endl;
+          usage(argc, argv);
+        }
+        break;
+      case 'O':
+        g_fOutputOnly = true;
+        break;
+      case 'a':
+        g_fAdaptiveBuffer = true;
+        break;
+      case 'o':
+        g_outputFile = optarg;
+        break;
+      case 'l':
+        g_renderSeconds = atof(optarg);
+        if (g_renderSeconds <= 0) {
+          std::cerr << "invalid render length -- " << optarg << std::endl;
+          usage(argc, argv);
+        }
+        break;
+      default:
+        usage(argc, argv);
+    }
+  }
+  // Positional arguments follow the options
+  int numArgs = argc - optind;
+  char** args = argv + optind;
+
+  // No peers to talk to when rendering to a file
+  if (!g_outputFile.empty())
+    return;
+
+  if (numArgs < 1) {
     std::cerr << "not enough arguments! need at least hostname of a peer" << std::endl;
     usage(argc, argv);
   } else {
-    g_peerHost = argv[1];
+    g_peerHost = args[0];
     int sepPos = g_peerHost.find(':');
     if (sepPos != string::npos) {
       g_peerPort = atoi(g_peerHost.substr(sepPos + 1).c_str());
@@ -110,8 +256,8 @@ void parseCommandLine( int argc, char ** argv )
     }
   }
 
-  if (argc > 2) {
-    g_port = atoi(argv[2]);
+  if (numArgs > 1) {
+    g_port = atoi(args[1]);
     if (g_port <= 0 || g_port == INT_MAX) {
       std::cerr << "invalid listen port -- " << g_port << std::endl;
       usage(argc, argv);
@@ -122,7 +268,6 @@ void parseCommandLine( int argc, char ** argv )
 void createInitialWidgets()
 {
   WidgetMap* widgets = Widget::getAll();
-  SoundSourceMap* soundSources = SoundSource::getAllForEngine();
 
   // New pad!
   RoundPad* pad = new RoundPad(Point2D(g_width / 4.0, g_height / 4.0), 100);
@@ -183,7 +328,7 @@ void createInitialWidgets()
   Point2D p1 = Spiral::getPointFromRadius(pad->getCenter(), 30, 330),
           p2 = Spiral::getPointFromRadius(pad->getCenter(), 90, 330);
   String* string = new String(p1, p2, pad->getRadius());
-  soundSources->insert(SoundSourceData(string->getUuid(), string));
+  SoundSource::addGlobal(string);
   widgets->insert(WidgetData(string->getUuid(), string));
   pad->addChild(string);
 
@@ -191,7 +336,7 @@ void createInitialWidgets()
   p1 = Spiral::getPointFromRadius(pad->getCenter(), 30, 210);
   p2 = Spiral::getPointFromRadius(pad->getCenter(), 90, 210);
   string = new String(p1, p2, pad->getRadius());
-  soundSources->insert(SoundSourceData(string->getUuid(), string));
+  SoundSource::addGlobal(string);
   widgets->insert(WidgetData(string->getUuid(), string));
   pad->addChild(string);
 
@@ -199,7 +344,7 @@ void createInitialWidgets()
   p1 = Spiral::getPointFromRadius(pad->getCenter(), 30, 90);
   p2 = Spiral::getPointFromRadius(pad->getCenter(), 90, 90);
   string = new String(p1, p2, pad->getRadius());
-  soundSources->insert(SoundSourceData(string->getUuid(), string));
+  SoundSource::addGlobal(string);
   widgets->insert(WidgetData(string->getUuid(), string));
   pad->addChild(string);
 }
@@ -212,6 +357,9 @@ int main( int argc, char ** argv )
 {
   parseCommandLine(argc, argv);
 
+  if (!g_outputFile.empty())
+    return renderOffline();
+
   g_pNetwork = new Network();
   g_pEngine = new Engine();
   g_pEngine->setSize(g_width, g_height);
@@ -234,30 +382,102 @@ int main( int argc, char ** argv )
 
   createInitialWidgets();
 
+  g_pSimulation = new Simulation(g_pEngine, g_simRate, g_simMode);
+  g_pEngine->setSimulation(g_pSimulation);
+  g_pSimulation->start();
+
   glutMainLoop();
 
   // cleanup
+  delete g_pSimulation;
   delete g_pEngine;
   delete g_pNetwork;
 
   return 0;
 }
 
+//-----------------------------------------------------------------------------
+// Name: renderOffline( )
+// Desc: Runs the simulation and synthesis without window or sound card,
+//       as fast as possible, into g_outputFile
+//-----------------------------------------------------------------------------
+int renderOffline()
+{
+  g_pEngine = new Engine();
+  g_pEngine->setSize(g_width, g_height);
+
+  stk::Stk::setSampleRate(g_sampleRate);
+
+  SoundSource::initializeGlobals();
+  SoundSource::setRealtimeClock(false);
+  String::initializeBank();
+  g_pRenderPool = new RenderPool(g_renderThreads, String::getBank(), MAX_BUFFER_FRAMES);
+
+  createInitialWidgets();
+  g_pSimulation = new Simulation(g_pEngine, g_simRate);
+
+  stk::FileWvOut output;
+  try {
+    output.openFile(g_outputFile, g_numChannels, stk::FileWrite::FILE_WAV, stk::Stk::STK_SINT16);
+  } catch (stk::StkError& error) {
+    std::cerr << "Error when opening " << g_outputFile << ": " << error.getMessage() << std::endl;
+    return 1;
+  }
+
+  std::vector<SAMPLE> buffer(g_bufferSize * g_numChannels);
+  stk::StkFrames frames(g_bufferSize, g_numChannels);
+  unsigned long long totalFrames = g_renderSeconds * g_sampleRate, rendered = 0;
+  double stepFrames = g_sampleRate / g_simRate;
+
+  // One simulation step per step's worth of audio, as the thread would do
+  double startTime = Clock::now();
+  for (unsigned long step = 0; rendered < totalFrames; step++) {
+    g_pSimulation->step();
+    SoundSource::publishGlobals();
+
+    unsigned long long stepEnd = std::min(totalFrames, (unsigned long long)((step + 1) * stepFrames));
+    while (rendered < stepEnd) {
+      unsigned int nFrames = std::min((unsigned long long)g_bufferSize, stepEnd - rendered);
+      renderBuffer(&buffer[0], nFrames);
+
+      frames.resize(nFrames, g_numChannels);
+      for (unsigned int i = 0; i < nFrames * g_numChannels; i++)
+        frames[i] = buffer[i];
+      output.tick(frames);
+      rendered += nFrames;
+    }
+  }
+  output.closeFile();
+
+  double elapsed = Clock::now() - startTime;
+  std::cerr << "Rendered " << g_renderSeconds << " s of audio in " << elapsed << " s ("
+            << g_renderSeconds / std::max(elapsed, 1e-9) << "x realtime)" << std::endl;
+
+  delete g_pSimulation;
+  delete g_pRenderPool;
+  delete g_pEngine;
+  return 0;
+}
+
 //-----------------------------------------------------------------------------
 // Name: initializeAudio( )
 // Desc: Initialize audio
 //-----------------------------------------------------------------------------
 void initializeAudio()
 {
-  SoundSource::initializeGlobals();
+  stk::Stk::setSampleRate(g_sampleRate);
 
-  stk::Stk::setSampleRate(MY_SRATE);
+  SoundSource::initializeGlobals();
+  String::initializeBank();
+  g_pRenderPool = new RenderPool(g_renderThreads, String::getBank(), MAX_BUFFER_FRAMES);
 
   srand(time(NULL));
-  g_pAudio = new MyAudio(g_numChannels, MY_SRATE, BUFFER_SIZE, RTAUDIO_FLOAT32);
+  g_pAudio = new MyAudio(g_numChannels, g_sampleRate, g_bufferSize, RTAUDIO_FLOAT32);
+  g_pAudio->setDevice(g_audioDevice);
+  g_pAudio->setOutputOnly(g_fOutputOnly);
   g_pAudio->setup(&audioCallback, NULL);
   g_pAudio->start();
-  
+
 }
 
 //-----------------------------------------------------------------------------
@@ -339,6 +559,10 @@ void initializeGfx()
   glutTimerFunc(TIMER_MSECS, idleFunc, 0);
   g_startTime = glutGet(GLUT_ELAPSED_TIME);
   g_prevTime = g_startTime;
+  g_statsLogTime = g_startTime;
+  AudioStats::take(g_loggedStats);
+  g_adaptTime = g_startTime;
+  g_adaptedStats = g_loggedStats;
 }
 
 //-----------------------------------------------------------------------------
@@ -383,7 +607,17 @@ void idleFunc(int value)
   int timeSincePrevFrame = currTime - g_prevTime;
   int elapsedTime = currTime - g_startTime;
 
-  // TODO: put 'tick' code here
+  // Audio health for the last period, away from the audio thread
+  if (currTime - g_statsLogTime >= AUDIO_STATS_LOG_SECS * 1000) {
+    AudioStatsSnapshot stats;
+    AudioStats::take(stats);
+    std::cerr << "[audio] " << AudioStats::describe(AudioStats::difference(stats, g_loggedStats)) << std::endl;
+    g_loggedStats = stats;
+    g_statsLogTime = currTime;
+  }
+
+  if (g_fAdaptiveBuffer)
+    adaptBufferSize(currTime);
 
   // Force a redisplay to render the new image
   glutPostRedisplay();
@@ -391,27 +625,101 @@ void idleFunc(int value)
   g_prevTime = currTime;
 }
 
+//-----------------------------------------------------------------------------
+// Name: adaptBufferSize( )
+// Desc: Grows the audio buffer after xruns, and shrinks it again once the
+//       callback load has left plenty of headroom for a while
+//-----------------------------------------------------------------------------
+void adaptBufferSize(int currTime)
+{
+  if (currTime - g_adaptTime < ADAPT_PERIOD_SECS * 1000)
+    return;
+
+  AudioStatsSnapshot stats;
+  AudioStats::take(stats);
+  AudioStatsSnapshot period = AudioStats::difference(stats, g_adaptedStats);
+  g_adaptTime = currTime;
+  g_adaptedStats = stats;
+  if (period.callbacks == 0)
+    return;
+
+  unsigned int bufferSize = g_pAudio->bufferSize(), newSize = bufferSize;
+  if (period.underflows > 0 || period.late > 0) {
+    g_stablePeriods = 0;
+    newSize = std::min(bufferSize * 2, (unsigned int)MAX_BUFFER_FRAMES);
+  } else if (AudioStats::getPercentile(period, 0.99) >= ADAPT_SHRINK_LOAD) {
+    // Only clean periods in a row count
+    g_stablePeriods = 0;
+  } else if (++g_stablePeriods >= ADAPT_STABLE_PERIODS) {
+    g_stablePeriods = 0;
+    newSize = std::max(bufferSize / 2, (unsigned int)MIN_BUFFER_FRAMES);
+  }
+
+  if (newSize != bufferSize) {
+    g_pAudio->reopen(newSize);
+    std::cerr << "[audio] buffer size " << bufferSize << " -> " << g_pAudio->bufferSize() << std::endl;
+
+    // Don't judge the new size by what happened around the switch
+    AudioStats::take(g_adaptedStats);
+  }
+}
+
 //-----------------------------------------------------------------------------
 // Name: displayFunc( )
 // Desc: callback function invoked to draw the client area
 //-----------------------------------------------------------------------------
 void displayFunc( )
 {
+  processInput();
+
+  // Drawing only reads the scene, so the simulation can step meanwhile
+  Simulation::lockSceneShared();
   g_pEngine->draw();
 
-  SoundSource::swapGlobals();
+  SoundSource::publishGlobals();
+  Simulation::unlockScene();
   glutSwapBuffers();
   glFlush();
   return;
 }
 
+//-----------------------------------------------------------------------------
+// Name: processInput( )
+// Desc: Handles the input queued since the last frame, in order
+//-----------------------------------------------------------------------------
+void processInput()
+{
+  static std::vector<InputEvent> events;
+  InputQueue::take(events);
+  for (size_t i = 0; i < events.size(); i++) {
+    const InputEvent& event = events[i];
+    if (event.type == InputEvent::MOTION)
+      handleMotion(event.x, event.y);
+    else if (event.type == InputEvent::BUTTON)
+      handleButton(event.button, event.state, event.x, event.y);
+    else
+      handleKey(event.key, event.x, event.y);
+  }
+}
+
 //-----------------------------------------------------------------------------
 // Name: keyboardFunc( )
 // Desc: respond to key events
 //-----------------------------------------------------------------------------
 void keyboardFunc( unsigned char key, int x, int y )
 {
+  InputQueue::pushKey(key, x, y);
+}
+
+//-----------------------------------------------------------------------------
+// Name: handleKey( )
+// Desc: A queued key event
+//-----------------------------------------------------------------------------
+void handleKey(unsigned char key, int x, int y)
+{
+  Simulation::lockScene();
   g_pEngine->onKeyDown(key, x, y);
+  Simulation::unlockScene();
 }
 
 //-----------------------------------------------------------------------------
@@ -420,10 +728,22 @@ void keyboardFunc( unsigned char key, int x, int y )
 //-----------------------------------------------------------------------------
 void mouseFunc( int button, int state, int x, int y )
 {
+  InputQueue::pushButton(button, state, x, y);
+  glutPostRedisplay( );
+}
+
+//-----------------------------------------------------------------------------
+// Name: handleButton( )
+// Desc: A queued mouse button event
+//-----------------------------------------------------------------------------
+void handleButton(int button, int state, int x, int y)
+{
+  Simulation::lockScene();
   if (state == GLUT_DOWN)
     g_pEngine->onMouseDown(button, x, y);
   else if (state == GLUT_UP)
     g_pEngine->onMouseUp(button, x, y);
+  Simulation::unlockScene();
 
   if( button == GLUT_LEFT_BUTTON ) {
     // when left mouse button is down
@@ -440,8 +760,6 @@ void mouseFunc( int button, int state, int x, int y )
     if( state == GLUT_DOWN ) {}
     else {}
   } else {}
-
-  glutPostRedisplay( );
 }
 
 //-----------------------------------------------------------------------------
@@ -449,10 +767,21 @@ void mouseFunc( int button, int state, int x, int y )
 // Desc:
 //-----------------------------------------------------------------------------
 void motionFunc(int x, int y)
+{
+  InputQueue::pushMotion(x, y);
+}
+
+//-----------------------------------------------------------------------------
+// Name: handleMotion( )
+// Desc: The last mouse position of a run of queued moves
+//-----------------------------------------------------------------------------
+void handleMotion(int x, int y)
 {
   setCursorVisibility(x, y);
 
   g_pNetwork->sendMousePosition(x, y, g_fLeftButton);
+
+  Simulation::lockScene();
   g_pEngine->setMouseCursorPosition(x, y);
   g_pEngine->setTextMode(Engine::TEXT_REPLACE);
   g_pEngine->setSelectedWidget(NULL);
@@ -461,6 +790,7 @@ void motionFunc(int x, int y)
     g_pEngine->onMouseMove(x, y);
   else
     g_pEngine->onMouseOver(x, y);
+  Simulation::unlockScene();
 }
 
 //-----------------------------------------------
@@ -470,27 +800,35 @@ void motionFunc(int x, int y)
 int audioCallback(void * outputBuffer, void * inputBuffer,
                   unsigned int bufferSize, double streamTime,
                   RtAudioStreamStatus status, void * userData) {
-  SAMPLE * out = (SAMPLE *)outputBuffer;
-  SAMPLE * in = (SAMPLE *)inputBuffer;
+  double start = Clock::now();
+  renderBuffer((SAMPLE *)outputBuffer, bufferSize);
+  AudioStats::record(Clock::now() - start, bufferSize / stk::Stk::sampleRate(),
+                     status & RTAUDIO_OUTPUT_UNDERFLOW, status & RTAUDIO_INPUT_OVERFLOW);
+  return 0;
+}
 
+//-----------------------------------------------
+// name: renderBuffer
+// desc: renders bufferSize frames of all sound sources into
+//       out, interleaved over g_numChannels
+//-----------------------------------------------
+void renderBuffer(SAMPLE* out, unsigned int bufferSize) {
   for(size_t i = 0; i < bufferSize; ++i)
     out[i * g_numChannels] = 0; // initialize first
 
-  SoundSource::lockGlobals();
-  {
-    SoundSourceMap *data = SoundSource::getAllForAudio();
+  unsigned long long frame = SoundSource::advanceClock(bufferSize);
+  const SoundSourceList* sources = SoundSource::acquireForAudio();
+  SoundSource::dispatchPlucks(sources, frame, bufferSize);
 
-    for(size_t i = 0; i < bufferSize; ++i)
-      for (SoundSourceMap::iterator ptr = data->begin(); ptr != data->end(); ptr++)
-        out[i * g_numChannels] += ptr->second->tick();
-  }
-  SoundSource::unlockGlobals();
+  StringBank* bank = String::getBank();
+  unsigned int activeVoices = g_pRenderPool->render(sources->rendered, out, bufferSize, g_numChannels);
+  activeVoices += bank->getActiveCount();
+  SoundSource::setVoiceCounts(activeVoices, bank->getVoiceCount() + sources->rendered.size());
+  SoundSource::releaseForAudio();
 
   for(size_t i = 0; i < bufferSize; ++i) {
     out[i * g_numChannels] = std::min(1.0f, std::max(-1.0f, out[i * g_numChannels]));
     for(size_t j = 1; j < g_numChannels; ++j)
       out[i * g_numChannels + j] = out[i * g_numChannels];
   }
-
-  return 0;
 }